@@ -1,9 +1,19 @@
 #include <Wire.h>
 #include <Adafruit_INA219.h>
 #include <driver/uart.h>
+#include "rs485_frame.h"
+
+typedef struct {
+  uint32_t rx_frames;
+  uint32_t bad_len;
+  uint32_t bad_crc;
+  uint32_t bad_etx;
+  uint32_t timeout;
+} UartStats_st;
 
 float SENSOR_GetCurrent_mA(void);
 
 void UART_Init();
+void UART_GetStats(UartStats_st *stats);
 
 void SENSOR_Setup();
\ No newline at end of file
@@ -0,0 +1,90 @@
+#pragma once
+/*
+ * CRC16-Modbus (reflected poly 0xA001, init 0xFFFF), table driven.
+ * Plain C++17, no Arduino headers, so the same file builds on the host.
+ *
+ * The lookup table is generated at compile time. Define
+ * CONFIG_CRC16_SLICE_BY_4 to 1 to trade 1.5 KB of extra flash for
+ * processing four bytes per iteration on long buffers.
+ *
+ * Usage:
+ *   uint16_t crc = CRC16_INIT;
+ *   crc = CRC16_Update(crc, byte);            // one byte at a time
+ *   crc = CRC16_UpdateBlock(crc, data, len);  // or whole blocks
+ *   crc = CRC16_Calculate(data, len);         // one shot
+ */
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef CONFIG_CRC16_SLICE_BY_4
+#define CONFIG_CRC16_SLICE_BY_4               0
+#endif
+
+#define CRC16_INIT                            0xFFFF
+#define CRC16_POLY                            0xA001
+
+#if (CONFIG_CRC16_SLICE_BY_4 == 1)
+#define CRC16_TABLE_COUNT                     4
+#else
+#define CRC16_TABLE_COUNT                     1
+#endif
+
+typedef struct {
+  uint16_t t[CRC16_TABLE_COUNT][256];
+} Crc16Table_st;
+
+constexpr Crc16Table_st CRC16_MakeTable()
+{
+  Crc16Table_st table = {};
+
+  for (uint16_t i = 0; i < 256; i++) {
+    uint16_t crc = i;
+    for (int j = 0; j < 8; j++) {
+      crc = (crc & 0x0001) ? ((crc >> 1) ^ CRC16_POLY) : (crc >> 1);
+    }
+    table.t[0][i] = crc;
+  }
+
+  /* t[k][i] is the CRC of byte i followed by k zero bytes */
+  for (int k = 1; k < CRC16_TABLE_COUNT; k++) {
+    for (uint16_t i = 0; i < 256; i++) {
+      uint16_t prev = table.t[k - 1][i];
+      table.t[k][i] = (prev >> 8) ^ table.t[0][prev & 0xFF];
+    }
+  }
+
+  return table;
+}
+
+inline constexpr Crc16Table_st CRC16_TABLE = CRC16_MakeTable();
+
+static_assert(CRC16_TABLE.t[0][1] == 0xC0C1, "CRC16 table generation is broken");
+
+inline uint16_t CRC16_Update(uint16_t crc, uint8_t data)
+{
+  return (crc >> 8) ^ CRC16_TABLE.t[0][(crc ^ data) & 0xFF];
+}
+
+inline uint16_t CRC16_UpdateBlock(uint16_t crc, const uint8_t *data, size_t len)
+{
+#if (CONFIG_CRC16_SLICE_BY_4 == 1)
+  while (len >= 4) {
+    crc ^= (uint16_t)(data[0] | (data[1] << 8));
+    crc = CRC16_TABLE.t[3][crc & 0xFF] ^ CRC16_TABLE.t[2][crc >> 8] ^
+          CRC16_TABLE.t[1][data[2]] ^ CRC16_TABLE.t[0][data[3]];
+    data += 4;
+    len -= 4;
+  }
+#endif
+
+  while (len--) {
+    crc = CRC16_Update(crc, *data++);
+  }
+
+  return crc;
+}
+
+inline uint16_t CRC16_Calculate(const uint8_t *data, size_t len)
+{
+  return CRC16_UpdateBlock(CRC16_INIT, data, len);
+}
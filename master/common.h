@@ -10,6 +10,9 @@
 #include <driver/uart.h>
 #include <vector>
 #include "ap_webpages.h"
+#include "rs485_frame.h"
+#include "spsc_ring.h"
+#include "espnow_discovery.h"
 
 #define DEVICE_TYPE_MASTER
 // #define DEVICE_TYPE_SLAVE
@@ -44,15 +47,42 @@ typedef enum {
 
 typedef uint8_t                           DeviceId_t;
 
+#define ESPNOW_MSG_VERSION                    1
+#define ESPNOW_mA_SCALE                       10      //Fixed point 0.1 mA
+#define ESPNOW_mV_SCALE                       1000    //Fixed point 1 mV
+
+/* First byte of every binary ESP-NOW message, never printable so it can't be confused with "DISCOVER" */
+typedef enum {
+  ESPNOW_MSG_TELEMETRY = (0x01),
+} EspNowMsgType_e;
+
+typedef struct {
+  uint8_t type;         //ESPNOW_MSG_TELEMETRY
+  uint8_t version;      //ESPNOW_MSG_VERSION
+  DeviceId_t id;
+  uint8_t alarms;       //Smoke/fire bits, this board has no alarm inputs and sends 0
+  int32_t mA;           //ESPNOW_mA_SCALE units, little endian
+  uint16_t mV;
+} __attribute__((packed)) EspNowTelemetry_st;
+
 typedef struct {
   uint8_t cmd;
   uint8_t *data;
   uint16_t len;
 } QueueMsg_st;
 
+typedef struct {
+  uint32_t rx_frames;
+  uint32_t bad_len;
+  uint32_t bad_crc;
+  uint32_t bad_etx;
+  uint32_t timeout;
+} UartStats_st;
+
 float SENSOR_GetCurrent_mA(void);
 void UART_Init();
 bool UART_SendBytes(uint8_t *data, uint16_t data_len);
+void UART_GetStats(UartStats_st *stats);
 
 void WIFI_Init();
 void WIFI_AP_ServerLoop();
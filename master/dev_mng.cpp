@@ -48,12 +48,18 @@ void DEVICES_UpdateInfo(DeviceId_t id, float mA, float V)
 
 void DEVICES_UpdateInfo(const uint8_t *data, int len)
 {
-  JsonDocument doc;
-  DeserializationError error = deserializeJson(doc, data, len);
-  if (DeserializationError::Ok == error)
-  {
-    DEVICES_UpdateInfo(doc["id"].as<int>(), doc["mA"].as<float>(), doc["V"].as<float>());
+  EspNowTelemetry_st msg;
+  if (len < (int)sizeof(msg)) {
+    return;
+  }
+
+  /* Copy out first, the radio buffer has no alignment guarantee */
+  memcpy(&msg, data, sizeof(msg));
+  if (msg.type != ESPNOW_MSG_TELEMETRY || msg.version != ESPNOW_MSG_VERSION) {
+    return;
   }
+
+  DEVICES_UpdateInfo(msg.id, (float)msg.mA / ESPNOW_mA_SCALE, (float)msg.mV / ESPNOW_mV_SCALE);
 }
 
 void dev_mng_task(void *param)
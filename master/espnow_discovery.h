@@ -0,0 +1,122 @@
+#pragma once
+/*
+ * How a slave finds the master's ESP-NOW channel.
+ *
+ * Channels are visited in ESPNOW_ChannelOrder(): the one cached in NVS, the
+ * ones routers usually sit on, then the rest. Each visit sends a burst of
+ * DISCOVER probes spread over the dwell time, and the dwell doubles after
+ * every sweep without an answer. The master's reply names its channel, so a
+ * reply that leaked in from a neighbouring channel still lands the slave on
+ * the right one.
+ *
+ * ESPNOW_DiscoverChannel() runs the loop against a RADIO with
+ *
+ *   void SetChannel(uint8_t chn)       radio and broadcast peer to chn
+ *   void SendProbe()                   one DISCOVER broadcast
+ *   uint8_t WaitReply(uint16_t ms)     the channel the reply named, 0 if none came in ms
+ *
+ * and is the only caller of SetChannel, so the channel the loop is probing
+ * and the channel it settles on can't be changed under it. The firmware
+ * passes the radio, the host simulation a model of one.
+ *
+ * Free of Arduino headers and never allocates.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define ESPNOW_CHANNEL_MIN                    1
+#define ESPNOW_CHANNEL_MAX                    11
+#define ESPNOW_CHANNEL_COUNT                  (ESPNOW_CHANNEL_MAX - ESPNOW_CHANNEL_MIN + 1)
+#define ESPNOW_PROBE_BURST                    3       //DISCOVER frames per channel visit
+#define ESPNOW_DWELL_MIN_MS                   30      //Per channel, doubled after every sweep without an answer
+#define ESPNOW_DWELL_MAX_MS                   480
+#define ESPNOW_MSG_DISCOVER                   "DISCOVER"
+
+inline bool ESPNOW_IsValidChannel(uint8_t chn)
+{
+  return ESPNOW_CHANNEL_MIN <= chn && chn <= ESPNOW_CHANNEL_MAX;
+}
+
+/* Cached channel first, then the channels routers usually sit on, then the rest. Returns the count */
+inline uint8_t ESPNOW_ChannelOrder(uint8_t cached, uint8_t order[ESPNOW_CHANNEL_COUNT])
+{
+  static const uint8_t preferred[] = { 1, 6, 11 };
+  uint16_t used = 0;
+  uint8_t count = 0;
+
+  if (ESPNOW_IsValidChannel(cached)) {
+    order[count++] = cached;
+    used |= (1 << cached);
+  }
+  for (uint8_t i = 0; i < sizeof(preferred); i++) {
+    if ( ! (used & (1 << preferred[i]))) {
+      order[count++] = preferred[i];
+      used |= (1 << preferred[i]);
+    }
+  }
+  for (uint8_t chn = ESPNOW_CHANNEL_MIN; chn <= ESPNOW_CHANNEL_MAX; chn++) {
+    if ( ! (used & (1 << chn))) {
+      order[count++] = chn;
+    }
+  }
+
+  return count;
+}
+
+/*
+ * The master's reply is "DISCOVER,<channel>". A bare "DISCOVER" is another
+ * slave probing, not an answer. Returns true and the channel for a reply
+ * naming a valid channel, false for anything else.
+ */
+inline bool ESPNOW_ParseDiscoverReply(const uint8_t *data, size_t len, uint8_t *channel)
+{
+  const size_t prefix = sizeof(ESPNOW_MSG_DISCOVER) - 1;
+  if (len < prefix + 2 || memcmp(data, ESPNOW_MSG_DISCOVER, prefix) != 0 || data[prefix] != ',') {
+    return false;
+  }
+
+  uint16_t value = 0;
+  size_t i = prefix + 1;
+  for ( ; i < len && '0' <= data[i] && data[i] <= '9' && value <= ESPNOW_CHANNEL_MAX; i++) {
+    value = value * 10 + (data[i] - '0');
+  }
+  if (i != len || ! ESPNOW_IsValidChannel(value)) {
+    return false;
+  }
+
+  *channel = (uint8_t)value;
+  return true;
+}
+
+/* Probes until the master answers and returns its channel, the radio is left on it. visits counts channel visits */
+template <class RADIO>
+uint8_t ESPNOW_DiscoverChannel(RADIO &radio, uint8_t cached, uint16_t *visits)
+{
+  uint8_t order[ESPNOW_CHANNEL_COUNT];
+  uint8_t count = ESPNOW_ChannelOrder(cached, order);
+  uint16_t dwell = ESPNOW_DWELL_MIN_MS;
+  *visits = 0;
+
+  while (1) {
+    for (uint8_t i = 0; i < count; i++) {
+      radio.SetChannel(order[i]);
+      (*visits)++;
+
+      for (uint8_t p = 0; p < ESPNOW_PROBE_BURST; p++) {
+        radio.SendProbe();
+        uint8_t reply = radio.WaitReply(dwell / ESPNOW_PROBE_BURST);
+        if (reply == 0) {
+          continue;
+        }
+        if (reply != order[i]) {
+          radio.SetChannel(reply);
+        }
+        return reply;
+      }
+    }
+
+    /* A busy master or a noisy band needs longer on each channel */
+    dwell = (dwell * 2 < ESPNOW_DWELL_MAX_MS) ? dwell * 2 : ESPNOW_DWELL_MAX_MS;
+  }
+}
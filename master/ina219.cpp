@@ -65,11 +65,14 @@ void sensor_task(void *arg)
     }
 
 #if defined(DEVICE_TYPE_SLAVE)
-    String msg = ("{\"id\":" + String(DB_GetDeviceId()) +
-                  ",\"mA\":" + String(_current_mA, 2) +
-                  ",\"V\":" + String(_busvoltage) +
-                  "}");
-    WIRELESS_Broadcast(msg);
+    EspNowTelemetry_st msg;
+    msg.type = ESPNOW_MSG_TELEMETRY;
+    msg.version = ESPNOW_MSG_VERSION;
+    msg.id = DB_GetDeviceId();
+    msg.alarms = 0;
+    msg.mA = lroundf(_current_mA * ESPNOW_mA_SCALE);
+    msg.mV = (uint16_t)constrain(lroundf(_busvoltage * ESPNOW_mV_SCALE), 0, UINT16_MAX);
+    WIRELESS_Broadcast((const uint8_t *)&msg, sizeof(msg));
 #endif
 
 #if defined(DEVICE_TYPE_MASTER)
@@ -7,17 +7,7 @@
 #define UART_BUFF_SIZE            1024
 #define UART_FRAME_TIMEOUT        100
 #define UART_PROTOCOL_BROADCAST   0x00
-
-#define STX                       0x02
-#define ETX                       0x03
-#define UART_PROTOCOL_CRC_LEN     2       //bytes
-
-typedef enum {
-  UART_STATE_IDLE = (0),
-  UART_STATE_LEN,
-  UART_STATE_DATA,
-  UART_STATE_ETX,
-} UartStates_e;
+#define UART_PROTOCOL_ADDR_LEN    1       //bytes
 
 typedef enum {
   UART_CMD_GET_CURRENT_mA = (0),
@@ -29,89 +19,62 @@ typedef enum {
   UART_TYPE_WRITE
 } UartTypes_e;
 
+/* STX - LEN - ID - (DATA) - CRC_H - CRC_L - ETX */
+typedef Rs485Frame<UART_PROTOCOL_ADDR_LEN> UartCodec;
+
+typedef struct {
+  uint8_t id;
+  uint16_t len;
+  uint8_t data[UartCodec::MAX_PAYLOAD];
+} UartFrame_st;
+
 static QueueHandle_t _uartQueue;
-static UartStates_e _uartState = UART_STATE_IDLE;
-
-static void LocalHandleIncommingData(uint8_t *data, uint16_t data_len);
-
-uint16_t LocalCalculateCrc16(uint8_t *data, uint16_t data_len) {
-  uint16_t crc = 0xFFFF;
-  for (size_t i = 0; i < data_len; i++) {
-    crc ^= data[i];
-    for (int j = 0; j < 8; j++) {
-      if (crc & 0x0001) {
-        crc >>= 1;
-        crc ^= 0xA001;
-      } else {
-        crc >>= 1;
-      }
-    }
-  }
-  return crc;
-}
+static UartCodec::Decoder _uartRx;
+
+/* Frames are handled on uart_event_task before the next byte is fed, one static buffer is enough */
+static UartFrame_st _uartFrame;
+static UartStats_st _uartStats = { 0 };
+
+static void LocalHandleIncommingData(const UartFrame_st *frame);
 
 static void uart_event_task(void *pvParameters)
 {
   uart_event_t event;
   uint8_t recv_data[UART_BUFF_SIZE];
-  uint8_t *pData = NULL;
-  uint16_t data_cnt = 0, data_len = 0;
-  unsigned long timeout = 0;
+
+  _uartRx.Attach(_uartFrame.data, sizeof(_uartFrame.data));
 
   while (1) {
-    if (xQueueReceive(*(QueueHandle_t*)pvParameters, (void *)&event, (_uartState == UART_STATE_IDLE)? portMAX_DELAY : pdMS_TO_TICKS(UART_FRAME_TIMEOUT))) {
+    if (xQueueReceive(*(QueueHandle_t*)pvParameters, (void *)&event, _uartRx.IsIdle()? portMAX_DELAY : pdMS_TO_TICKS(UART_FRAME_TIMEOUT))) {
       switch (event.type) {
         case UART_DATA: {
           int len = uart_read_bytes(UART_PORT, recv_data, event.size, portMAX_DELAY);
           for (int i = 0; i < len; i++)
           {
             log_d("%02X", recv_data[i]);
-            switch (_uartState)
+
+            switch (_uartRx.Feed(recv_data[i]))
             {
-              case UART_STATE_IDLE:
-                if (recv_data[i] == STX) {
-                  if (pData) {
-                    free(pData);
-                    pData = NULL;
-                  }
-                  _uartState = UART_STATE_LEN;
-                }
+              case RS485_RX_FRAME:
+                _uartStats.rx_frames++;
+                _uartFrame.id = _uartRx.Address();
+                _uartFrame.len = _uartRx.PayloadLen();
+                LocalHandleIncommingData(&_uartFrame);
                 break;
-              case UART_STATE_LEN:
-                data_len = recv_data[i];
-                if (data_len > UART_PROTOCOL_CRC_LEN) {
-                  pData = (uint8_t *)malloc(data_len);
-                  if (pData) {
-                    data_cnt = 0;
-                    _uartState = UART_STATE_DATA;
-                  } else {
-                    log_e("Failed to allocate memory: %d (bytes)", data_len);
-                    _uartState = UART_STATE_IDLE;
-                  }
-                } else {
-                  log_e("Invalid data length: %d", data_len);
-                  _uartState = UART_STATE_IDLE;
-                }
+              case RS485_RX_ERR_LEN:
+                _uartStats.bad_len++;
+                log_e("Invalid data length");
                 break;
-              case UART_STATE_DATA:
-                pData[data_cnt++] = recv_data[i];
-                if (data_cnt >= data_len) {
-                  _uartState = UART_STATE_ETX;
-                }
+              case RS485_RX_ERR_CRC:
+                _uartStats.bad_crc++;
+                log_e("Invalid CRC");
                 break;
-              case UART_STATE_ETX:
-                if (recv_data[i] == ETX) {
-                  LocalHandleIncommingData(pData, data_len);
-                } else {
-                  log_e("Invalid ETX: 0x%X", recv_data[i]);
-                }
-
-                _uartState = UART_STATE_IDLE;
+              case RS485_RX_ERR_ETX:
+                _uartStats.bad_etx++;
+                log_e("Invalid ETX: 0x%X", recv_data[i]);
                 break;
               default: break;
             }
-
-            timeout = millis();
           }
           break;
         }
@@ -121,9 +84,10 @@ static void uart_event_task(void *pvParameters)
     }
     else
     {
-      if (_uartState != UART_STATE_IDLE) {
+      if ( ! _uartRx.IsIdle()) {
+        _uartStats.timeout++;
         log_e("Timeout!");
-        _uartState = UART_STATE_IDLE;
+        _uartRx.Reset();
       }
     }
   }
@@ -131,54 +95,39 @@ static void uart_event_task(void *pvParameters)
 
 bool UART_SendBytes(uint8_t *data, uint16_t data_len)
 {
-  int sent_len = 0;
-  uint16_t packet_len = data_len + 5;
-  uint8_t *packet = (uint8_t *)malloc(packet_len);
-  if (packet) {
-    packet[0] = STX;
-    packet[1] = data_len + 2;  //ID and CRC16
-    // packet[2] = DEVICE_ID;
-    memcpy(&packet[2], data, data_len);
-    uint16_t crc = LocalCalculateCrc16(&packet[1], data_len + 1);
-    packet[packet_len - 3] = crc >> 8;
-    packet[packet_len - 2] = crc & 0xFF;
-    packet[packet_len - 1] = ETX;
-    // sent_len = uart_write_bytes(UART_PORT, packet, packet_len);
-    sent_len = Serial.write(packet, packet_len);
-
-    free(packet);
+  /* STX - LEN - (DATA) - CRC_H - CRC_L - ETX, no ID */
+  uint8_t packet[Rs485Frame<0>::MAX_FRAME];
+  size_t packet_len = Rs485Frame<0>::Encode(packet, sizeof(packet), 0, data, data_len);
+  if (packet_len == 0) {
+    log_e("Invalid data length: %d", data_len);
+    return false;
   }
 
+  int sent_len = Serial.write(packet, packet_len);
   return (sent_len == packet_len);
 }
 
 bool UART1_SendBytes(uint8_t *data, uint16_t data_len)
 {
-  int sent_len = 0;
-  uint16_t packet_len = data_len + 6;
-  uint8_t *packet = (uint8_t *)malloc(packet_len);
-  if (packet) {
-    packet[0] = STX;
-    packet[1] = data_len + 3;  //ID and CRC16
-    packet[2] = CONFIG_MASTER_DEVICE_ID;
-    memcpy(&packet[3], data, data_len);
-    uint16_t crc = LocalCalculateCrc16(&packet[1], data_len + 2);
-    packet[packet_len - 3] = crc >> 8;
-    packet[packet_len - 2] = crc & 0xFF;
-    packet[packet_len - 1] = ETX;
-    sent_len = uart_write_bytes(UART_PORT, packet, packet_len);
-
-    free(packet);
+  uint8_t packet[UartCodec::MAX_FRAME];
+  size_t packet_len = UartCodec::Encode(packet, sizeof(packet), CONFIG_MASTER_DEVICE_ID, data, data_len);
+  if (packet_len == 0) {
+    log_e("Invalid data length: %d", data_len);
+    return false;
   }
 
+  int sent_len = uart_write_bytes(UART_PORT, packet, packet_len);
   return (sent_len == packet_len);
 }
 
-void LocalHandleIncommingData(uint8_t *data, uint16_t data_len)
+void LocalHandleIncommingData(const UartFrame_st *frame)
 {
-  if (data_len > 1) {
-    uint8_t id = data[0];
-    UartCmds_e cmd = (UartCmds_e)data[1];
+  uint8_t id = frame->id;
+  const uint8_t *data = frame->data;
+  uint16_t data_len = frame->len;
+
+  if (data_len > 0) {
+    UartCmds_e cmd = (UartCmds_e)data[0];
 
     if (id == UART_PROTOCOL_BROADCAST || id == CONFIG_MASTER_DEVICE_ID)
     {
@@ -202,6 +151,13 @@ void LocalHandleIncommingData(uint8_t *data, uint16_t data_len)
   }
 }
 
+void UART_GetStats(UartStats_st *stats)
+{
+  if (stats) {
+    memcpy(stats, &_uartStats, sizeof(UartStats_st));
+  }
+}
+
 void UART_Init()
 {
   _uartQueue = xQueueCreate(1024, sizeof(char));
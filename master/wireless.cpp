@@ -3,6 +3,9 @@
 
 #define TCP_QUEUE_SIZE                        10
 
+#define ESPNOW_RX_RING_SIZE                   16
+#define ESPNOW_RX_DATA_MAX                    32      //Our messages are a dozen bytes, anything longer is not ours
+
 uint8_t _broadcastAddress[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 
 #if defined(DEVICE_TYPE_MASTER)
@@ -18,49 +21,116 @@ static QueueHandle_t _tcpQ = NULL;
 
 #if defined(DEVICE_TYPE_SLAVE)
 static bool espnowDiscovered_ = false;
+static uint8_t _replyChannel = 0;                 //espnow_rx_task -> discovery task, 0 when none is pending
+static SemaphoreHandle_t _replySignal = NULL;     //Given with every reply, outlives the discovery task
 static bool LocalModifyBroadcastPeer(uint8_t new_channel);
 #endif
 
-static const char *MSG_DISCOVER = "DISCOVER";
+typedef struct {
+  uint8_t src[ESP_NOW_ETH_ALEN];
+  uint8_t len;
+  uint8_t data[ESPNOW_RX_DATA_MAX];
+} EspNowRxFrame_st;
+
+static SpscRing<EspNowRxFrame_st, ESPNOW_RX_RING_SIZE> _espnowRxRing;  //Wi-Fi task -> espnow_rx_task
+static TaskHandle_t _espnowRxTask = NULL;
+static volatile uint32_t _espnowRxOversize = 0;
+
+static const char *MSG_DISCOVER = ESPNOW_MSG_DISCOVER;
 esp_now_peer_info_t broadcastPeer_ = {0};
 
+/* Runs on the Wi-Fi task: copy the frame out for espnow_rx_task and leave */
 void onBroadcastReceive(const esp_now_recv_info_t *info, const uint8_t *data, int len)
 {
-  log_i("Received a message from " MACSTR " - len: %d - %.*s", MAC2STR(info->src_addr), len, len, data);
+  if (len <= 0 || len > ESPNOW_RX_DATA_MAX) {
+    _espnowRxOversize++;
+    return;
+  }
+
+  EspNowRxFrame_st *frame = _espnowRxRing.PushBegin();
+  if (frame == NULL) {
+    return;
+  }
+
+  memcpy(frame->src, info->src_addr, ESP_NOW_ETH_ALEN);
+  frame->len = len;
+  memcpy(frame->data, data, len);
+  _espnowRxRing.PushCommit();
+
+  if (_espnowRxTask) {
+    xTaskNotifyGive(_espnowRxTask);
+  }
+}
+
+/* Returns true for a master side DISCOVER request, answered once per batch */
+static bool LocalHandleEspnowFrame(const EspNowRxFrame_st *frame)
+{
+  const uint8_t *data = frame->data;
+  int len = frame->len;
+
+  log_d("Received a message from " MACSTR " - len: %d", MAC2STR(frame->src), len);
+  if (data[0] == ESPNOW_MSG_TELEMETRY) {
 #if defined(DEVICE_TYPE_MASTER)
-  if (memcmp(MSG_DISCOVER, data, len) == 0) {
-    WIRELESS_Broadcast(String(MSG_DISCOVER) + "," + String(broadcastPeer_.channel));
-  } else {
     DEVICES_UpdateInfo(data, len);
+#endif
+    /* Slaves hear each other's broadcasts, nothing to do */
+    return false;
+  }
+
+#if defined(DEVICE_TYPE_MASTER)
+  if (len == (int)strlen(MSG_DISCOVER) && memcmp(MSG_DISCOVER, data, len) == 0) {
+    return true;
   }
+  log_e("Unhandled message, len: %d", len);
 #endif
 
 #if defined(DEVICE_TYPE_SLAVE)
-  if (memcmp(MSG_DISCOVER, data, strlen(MSG_DISCOVER)) == 0) {
-    espnowDiscovered_ = true;
+  uint8_t channel;
+  if (ESPNOW_ParseDiscoverReply(data, len, &channel)) {
+    /* Only the discovery task moves the radio, it gets the reply and decides */
+    log_d("DISCOVER reply, channel %d", channel);
+    __atomic_store_n(&_replyChannel, channel, __ATOMIC_RELEASE);
+    xSemaphoreGive(_replySignal);
+  } else if (len == (int)strlen(MSG_DISCOVER) && memcmp(MSG_DISCOVER, data, len) == 0) {
+    /* Another slave probing */
+  } else {
+    log_e("Unhandled message: %.*s", len, data);
+  }
+#endif
 
-    String msg = String(data, len);
-    uint8_t discovered_channel = 0;
-    size_t commaIndex = msg.indexOf(',');
+  return false;
+}
 
-    if (commaIndex != -1) {
-      String numStr = msg.substring(commaIndex + 1);
-      int value = numStr.toInt();
-      discovered_channel = value;
-    } else {
-      discovered_channel = broadcastPeer_.channel;
+static void espnow_rx_task(void *param)
+{
+  uint32_t lastDropped = 0, lastOversize = 0;
+
+  while (1)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    EspNowRxFrame_st *frame;
+    bool discover = false;
+    uint8_t batch = 0;
+    while ((frame = _espnowRxRing.PopBegin()) != NULL) {
+      discover |= LocalHandleEspnowFrame(frame);
+      _espnowRxRing.PopCommit();
+      batch++;
     }
 
-    log_i("Discovered Channel: %d", discovered_channel);
-    DB_SetEspNowChannel(discovered_channel);
+    /* Slaves discovering in the same burst all get one answer */
+    if (discover) {
+      WIRELESS_Broadcast(String(MSG_DISCOVER) + "," + String(broadcastPeer_.channel));
+    }
+    log_d("ESP-NOW batch of %d", batch);
 
-    if (discovered_channel != broadcastPeer_.channel) {
-      LocalModifyBroadcastPeer(discovered_channel);
+    if (_espnowRxRing.Dropped() != lastDropped || _espnowRxOversize != lastOversize) {
+      log_e("ESP-NOW rx dropped %u, oversize %u (high water %u/%u)", _espnowRxRing.Dropped() - lastDropped,
+            _espnowRxOversize - lastOversize, _espnowRxRing.HighWater(), _espnowRxRing.Capacity());
+      lastDropped = _espnowRxRing.Dropped();
+      lastOversize = _espnowRxOversize;
     }
-  } else {
-    log_e("Unhandled message: %.*s", len, data);
   }
-#endif
 }
 
 void OnDataSent(const esp_now_send_info_t *tx_info, esp_now_send_status_t status)
@@ -137,30 +207,47 @@ bool LocalRegisterBroadcastPeer(const uint8_t *mac_addr, uint8_t channel)
 
 #if defined(DEVICE_TYPE_SLAVE)
 bool WIRELESS_IsDiscovered() {
-  return espnowDiscovered_;
+  return __atomic_load_n(&espnowDiscovered_, __ATOMIC_ACQUIRE);
 }
 
-void WIRELESS_ChannelDiscoverLoop(byte channel_start)
+/* The radio as ESPNOW_DiscoverChannel() drives it, from the discovery task only */
+class DiscoveryRadio
 {
-  byte chn = channel_start;
+public:
+  void SetChannel(uint8_t chn)
+  {
+    WiFi.setChannel(chn);
+    LocalModifyBroadcastPeer(chn);
+  }
 
-  do {
-    log_i("Discovering on channel %d", chn);
-    {
-      WiFi.setChannel(chn);
-      LocalModifyBroadcastPeer(chn);
-      WIRELESS_Broadcast((const uint8_t *)MSG_DISCOVER, strlen(MSG_DISCOVER));
-      delay(2000);
-      if (espnowDiscovered_) {
-        break;
-      }
-    }
+  void SendProbe()
+  {
+    WIRELESS_Broadcast((const uint8_t *)MSG_DISCOVER, strlen(MSG_DISCOVER));
+  }
 
-    chn++;
-    if (chn > 11) {
-      chn = 1;
+  uint8_t WaitReply(uint16_t ms)
+  {
+    if (xSemaphoreTake(_replySignal, pdMS_TO_TICKS(ms)) != pdTRUE) {
+      return 0;
     }
-  } while (1);
+    return __atomic_exchange_n(&_replyChannel, 0, __ATOMIC_ACQ_REL);
+  }
+};
+
+void WIRELESS_ChannelDiscoverLoop(byte channel_start)
+{
+  DiscoveryRadio radio;
+  uint16_t visits;
+  uint32_t start = millis();
+
+  /* Nothing from an earlier run counts */
+  __atomic_store_n(&_replyChannel, 0, __ATOMIC_RELEASE);
+  xSemaphoreTake(_replySignal, 0);
+
+  uint8_t channel = ESPNOW_DiscoverChannel(radio, channel_start, &visits);
+  DB_SetEspNowChannel(channel);
+  __atomic_store_n(&espnowDiscovered_, true, __ATOMIC_RELEASE);
+  log_i("Discovered channel %d in %u ms, %d channel visits", channel, millis() - start, visits);
 }
 
 void espnow_channel_discovery(void *param)
@@ -207,12 +294,20 @@ void WIRELESS_Init()
   log_i("WiFi Started! Parameters:");
   log_i("  MAC Address: " MACSTR " ", MAC2STR(WiFi.macAddress()));
   log_i("  ESPNOW Channel: %d", broadcastPeer_.channel);
+
+  if (_replySignal == NULL) {
+    _replySignal = xSemaphoreCreateBinary();
+  }
 #endif
 
 #if defined(DEVICE_TYPE_MASTER)
   broadcastPeer_.channel = WiFi.channel();
 #endif
 
+  if (_espnowRxTask == NULL) {
+    xTaskCreate(espnow_rx_task, "espnow_rx_task", 4096, NULL, 2, &_espnowRxTask);
+  }
+
   if (esp_now_init() != ESP_OK) {
     log_e("Error initializing ESP-NOW");
     while(1) { delay(500); }
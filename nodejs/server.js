@@ -52,16 +52,24 @@ function  delay(time){
 }
 
 // ===== CRC16 (Modbus) =====
+const CRC16_TABLE = (() => {
+  const table = new Uint16Array(256);
+  for (let i = 0; i < 256; i++) {
+    let crc = i;
+    for (let j = 0; j < 8; j++) {
+      crc = (crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+    }
+    table[i] = crc;
+  }
+  return table;
+})();
+
 function crc16(buf) {
   let crc = 0xFFFF;
-  for (let b of buf) {
-    crc ^= b;
-    for (let i = 0; i < 8; i++) {
-      if (crc & 1) crc = (crc >> 1) ^ 0xA001;
-      else crc >>= 1;
-    }
+  for (let i = 0; i < buf.length; i++) {
+    crc = (crc >> 8) ^ CRC16_TABLE[(crc ^ buf[i]) & 0xFF];
   }
-  return crc & 0xFFFF;
+  return crc;
 }
 
 function cuLockCheckSum(arr) {
@@ -72,22 +80,6 @@ function cuLockCheckSum(arr) {
     return sum & 0xff;
 }
 
-function crc16_modbus(buffer) {
-  let crc = 0xFFFF;
-  for (let i = 0; i < buffer.length; i++) {
-    crc ^= buffer[i];
-    for (let j = 0; j < 8; j++) {
-      if (crc & 0x0001) {
-        crc >>= 1;
-        crc ^= 0xA001;
-      } else {
-        crc >>= 1;
-      }
-    }
-  }
-  return crc & 0xFFFF;
-}
-
 function dumpArrayHex(header, arr) {
   console.log(header, arr.toString('hex').match(/.{1,2}/g).join(' '));
 }
@@ -115,7 +107,7 @@ function buildPacket(id, cmd, data) {
   const len = 4 + data.length; // ID + CMD + DATA
   const payload = [len, id, cmd, ...data];
 
-  const crc = crc16_modbus(Buffer.from(payload));
+  const crc = crc16(Buffer.from(payload));
   const crc_h = (crc >> 8) & 0xFF;
   const crc_l = crc & 0xFF;
 
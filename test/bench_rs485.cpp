@@ -0,0 +1,125 @@
+/*
+ * RS485 receive path benchmark: frames/sec through the encoder and through
+ * the decoder wired up the way uart_event_task does it (one static frame,
+ * attached once), and the number of heap calls made per received frame.
+ *
+ *   bench_rs485 [frames]
+ *
+ * Exits non zero if the receive loop touched the heap or lost a frame.
+ * Heap calls are counted by wrapping malloc and friends at link time and
+ * by replacing the global operator new and delete.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <new>
+#include <vector>
+#include "rs485_frame.h"
+
+#define BENCH_BAUDRATE            115200
+#define BENCH_BITS_PER_BYTE       10
+
+static size_t _heapCalls = 0;
+
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+void __real_free(void *p);
+
+void *__wrap_malloc(size_t size) { _heapCalls++; return __real_malloc(size); }
+void *__wrap_calloc(size_t n, size_t size) { _heapCalls++; return __real_calloc(n, size); }
+void *__wrap_realloc(void *p, size_t size) { _heapCalls++; return __real_realloc(p, size); }
+void __wrap_free(void *p) { if (p) { _heapCalls++; } __real_free(p); }
+}
+
+void *operator new(size_t size)
+{
+  void *p = __wrap_malloc(size ? size : 1);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { __wrap_free(p); }
+void operator delete[](void *p) noexcept { __wrap_free(p); }
+void operator delete(void *p, size_t) noexcept { __wrap_free(p); }
+void operator delete[](void *p, size_t) noexcept { __wrap_free(p); }
+
+typedef Rs485Frame<1> UartCodec;
+
+/* Same layout as uart_hdl.cpp */
+typedef struct {
+  uint8_t id;
+  uint16_t len;
+  uint8_t data[UartCodec::MAX_PAYLOAD];
+} UartFrame_st;
+
+static UartFrame_st _uartFrame;
+static UartCodec::Decoder _uartRx;
+static uint32_t _handled = 0;
+static uint32_t _checksum = 0;
+
+static void LocalHandleIncommingData(const UartFrame_st *frame)
+{
+  _handled++;
+  _checksum += frame->id + frame->len + (frame->len ? frame->data[0] : 0);
+}
+
+static double LocalSeconds(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+  size_t frames = (argc > 1) ? strtoul(argv[1], NULL, 10) : 2000000;
+
+  /* Poll replies as the slaves send them: [CMD] [mA f32] [V f32] [smoke] [fire], plus a few register reads */
+  std::vector<uint8_t> stream;
+  stream.reserve(frames * UartCodec::MAX_FRAME / 8);
+  uint8_t payload[UartCodec::MAX_PAYLOAD];
+  uint8_t frame[UartCodec::MAX_FRAME];
+
+  auto start = std::chrono::steady_clock::now();
+  size_t expected = 0;
+  for (size_t i = 0; i < frames; i++) {
+    size_t payload_len = (i % 8 == 7) ? 37 : 11;
+    for (size_t j = 0; j < payload_len; j++) {
+      payload[j] = (uint8_t)(i + j);
+    }
+    size_t len = UartCodec::Encode(frame, sizeof(frame), 1 + i % 32, payload, payload_len);
+    stream.insert(stream.end(), frame, frame + len);
+    expected += (len > 0);
+  }
+  double encode_s = LocalSeconds(start);
+
+  _uartRx.Attach(_uartFrame.data, sizeof(_uartFrame.data));
+
+  _heapCalls = 0;
+  start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < stream.size(); i++) {
+    if (_uartRx.Feed(stream[i]) == RS485_RX_FRAME) {
+      _uartFrame.id = _uartRx.Address();
+      _uartFrame.len = _uartRx.PayloadLen();
+      LocalHandleIncommingData(&_uartFrame);
+    }
+  }
+  double decode_s = LocalSeconds(start);
+  size_t heap_calls = _heapCalls;
+
+  double line_fps = (double)BENCH_BAUDRATE / BENCH_BITS_PER_BYTE / ((double)stream.size() / frames);
+  printf("encode: %.0f frames/s\n", frames / encode_s);
+  printf("decode: %.0f frames/s, %.1f MB/s (line rate at %u baud: %.0f frames/s)\n",
+         _handled / decode_s, stream.size() / decode_s / 1e6, BENCH_BAUDRATE, line_fps);
+  printf("heap calls in the receive loop: %zu for %u frames (checksum %u)\n", heap_calls, _handled, _checksum);
+
+  if (heap_calls != 0 || _handled != expected) {
+    fprintf(stderr, "FAIL: expected %zu frames and no heap calls\n", expected);
+    return 1;
+  }
+  return 0;
+}
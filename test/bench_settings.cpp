@@ -0,0 +1,95 @@
+/*
+ * Settings benchmark: per frame cost of the device id lookups the UART path
+ * makes, reading NVS every time the way db.cpp used to against the RAM copy
+ * db.cpp keeps now. Links the real db.cpp against the host Preferences
+ * fake, which counts every NVS access.
+ *
+ *   bench_settings [frames]
+ *
+ * The host fake has no flash latency, so the time column only shows the
+ * code path; on the device each namespace open is a flash access on top.
+ * Exits non zero if the cached path still touches NVS per frame or a
+ * repeated write is not skipped.
+ */
+#include <chrono>
+#include "common.h"
+
+#define BENCH_LOOKUPS_PER_FRAME   2       //Address match on receive, source id on the reply
+
+/* DB_GetDeviceId() before the RAM copy */
+static int LocalNvsGetDeviceId(int default_value)
+{
+  Preferences pref;
+  pref.begin("settings", true);
+  int dev_id = pref.getInt("device-id", default_value);
+  pref.end();
+  return dev_id;
+}
+
+typedef int (*GetDeviceId_t)(int default_value);
+
+static void LocalRun(const char *name, GetDeviceId_t get, size_t frames)
+{
+  PreferencesStats_st before = Preferences::stats;
+  volatile int sink = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < frames; i++) {
+    for (int j = 0; j < BENCH_LOOKUPS_PER_FRAME; j++) {
+      sink = sink + get(2);
+    }
+  }
+  double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  printf("%-8s %10.1f ns/frame %8.2f opens/frame %8.2f reads/frame\n", name, s * 1e9 / frames,
+         (double)(Preferences::stats.begins - before.begins) / frames,
+         (double)(Preferences::stats.reads - before.reads) / frames);
+}
+
+int main(int argc, char **argv)
+{
+  size_t frames = (argc > 1) ? strtoul(argv[1], NULL, 10) : 1000000;
+  int failures = 0;
+
+  Preferences::Clear();
+  Preferences seed;
+  seed.begin("settings", false);
+  seed.putInt("device-id", 5);
+  seed.end();
+
+  DB_Init();
+  if (DB_GetDeviceId() != 5 || LocalNvsGetDeviceId(2) != 5) {
+    fprintf(stderr, "FAIL: device id not loaded\n");
+    failures++;
+  }
+
+  LocalRun("nvs", LocalNvsGetDeviceId, frames);
+
+  uint32_t begins = Preferences::stats.begins;
+  LocalRun("cached", DB_GetDeviceId, frames);
+  if (Preferences::stats.begins != begins) {
+    fprintf(stderr, "FAIL: cached lookups opened NVS\n");
+    failures++;
+  }
+
+  /* Write through with change detection: the same value twice is one commit */
+  uint32_t writes = Preferences::stats.writes;
+  DB_SetUartBaudrate(57600);
+  DB_SetUartBaudrate(57600);
+  if (Preferences::stats.writes - writes != 1 || DB_GetUartBaudrate(0) != 57600) {
+    fprintf(stderr, "FAIL: baudrate write not deduplicated\n");
+    failures++;
+  }
+
+  /* Credentials go under a journal entry: mark, ssid, password, clear */
+  String ssid("locker-net"), pass("secret");
+  writes = Preferences::stats.writes;
+  DB_SetWifiCredentials(ssid, pass);
+  DB_SetWifiCredentials(ssid, pass);
+  if (Preferences::stats.writes - writes != 4) {
+    fprintf(stderr, "FAIL: credentials write count %u\n", Preferences::stats.writes - writes);
+    failures++;
+  }
+
+  return failures ? 1 : 0;
+}
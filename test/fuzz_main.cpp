@@ -0,0 +1,120 @@
+/*
+ * Stand in for libFuzzer on compilers without it.
+ *
+ *   fuzz_rs485_decoder [runs]      generated inputs, deterministic
+ *   fuzz_rs485_decoder file...     replay crashers or a corpus
+ *
+ * Generated inputs mix random bytes with valid frames that get bytes
+ * flipped, dropped or duplicated, so both the reject paths and the accept
+ * path are covered.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "rs485_frame.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static uint32_t _rngState = 1;
+
+static uint32_t LocalRand()
+{
+  /* xorshift32, same sequence on every host */
+  _rngState ^= _rngState << 13;
+  _rngState ^= _rngState >> 17;
+  _rngState ^= _rngState << 5;
+  return _rngState;
+}
+
+static void LocalAppendFrame(std::vector<uint8_t> &input)
+{
+  typedef Rs485Frame<1> Codec;
+  uint8_t payload[Codec::MAX_PAYLOAD];
+  uint8_t frame[Codec::MAX_FRAME];
+
+  size_t payload_len = LocalRand() % 40;
+  for (size_t i = 0; i < payload_len; i++) {
+    payload[i] = LocalRand();
+  }
+  size_t len = Codec::Encode(frame, sizeof(frame), LocalRand() & 0xFF, payload, payload_len);
+  input.insert(input.end(), frame, frame + len);
+}
+
+static void LocalMutate(std::vector<uint8_t> &input)
+{
+  if (input.size() < 2) {
+    return;
+  }
+
+  size_t pos = 1 + LocalRand() % (input.size() - 1);
+  switch (LocalRand() % 4)
+  {
+    case 0: input[pos] ^= 1 << (LocalRand() % 8); break;
+    case 1: input.erase(input.begin() + pos); break;
+    case 2: input.insert(input.begin() + pos, input[pos]); break;
+    default: input[pos] = LocalRand() % 2 ? RS485_FRAME_STX : RS485_FRAME_ETX; break;
+  }
+}
+
+static int LocalReplay(const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "Can't open %s\n", path);
+    return 1;
+  }
+
+  std::vector<uint8_t> input;
+  uint8_t chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+    input.insert(input.end(), chunk, chunk + n);
+  }
+  fclose(f);
+
+  LLVMFuzzerTestOneInput(input.data(), input.size());
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc > 1 && atol(argv[1]) == 0) {
+    int failed = 0;
+    for (int i = 1; i < argc; i++) {
+      failed |= LocalReplay(argv[i]);
+    }
+    return failed;
+  }
+
+  long runs = (argc > 1) ? atol(argv[1]) : 100000;
+  std::vector<uint8_t> input;
+
+  for (long run = 0; run < runs; run++) {
+    input.clear();
+    input.push_back(LocalRand() & 0xFF);    //Attached buffer size
+
+    size_t parts = 1 + LocalRand() % 4;
+    for (size_t p = 0; p < parts; p++) {
+      if (LocalRand() % 3 == 0) {
+        size_t noise = LocalRand() % 32;
+        for (size_t i = 0; i < noise; i++) {
+          input.push_back(LocalRand());
+        }
+      } else {
+        LocalAppendFrame(input);
+      }
+    }
+
+    size_t mutations = LocalRand() % 3;
+    for (size_t m = 0; m < mutations; m++) {
+      LocalMutate(input);
+    }
+
+    LLVMFuzzerTestOneInput(input.data(), input.size());
+  }
+
+  printf("%ld runs\n", runs);
+  return 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * libFuzzer target for the RS485 frame decoder.
+ *
+ * The first input byte picks the attached payload buffer size, the rest is
+ * fed to the decoder a byte at a time, for 1 and 2 byte addresses. Whenever
+ * a frame is accepted it must encode back to exactly the bytes that were
+ * just fed, and the payload must have stayed inside the attached buffer.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rs485_frame.h"
+
+template <size_t ADDR_LEN>
+static void LocalFuzz(const uint8_t *data, size_t size, size_t buf_size)
+{
+  typedef Rs485Frame<ADDR_LEN> Codec;
+
+  /* Heap buffer of exactly buf_size so ASan sees any overrun */
+  uint8_t *buf = buf_size ? (uint8_t *)malloc(buf_size) : nullptr;
+  uint8_t frame[Codec::MAX_FRAME];
+  typename Codec::Decoder rx;
+  rx.Attach(buf, buf_size);
+
+  for (size_t i = 0; i < size; i++) {
+    Rs485RxResult_e result = rx.Feed(data[i]);
+    if (result != RS485_RX_FRAME) {
+      continue;
+    }
+
+    size_t payload_len = rx.PayloadLen();
+    if (payload_len > buf_size) {
+      abort();
+    }
+
+    size_t len = Codec::Encode(frame, sizeof(frame), rx.Address(), buf, payload_len);
+    if (len != payload_len + Codec::OVERHEAD || len > i + 1 || memcmp(frame, &data[i + 1 - len], len) != 0) {
+      abort();
+    }
+  }
+
+  free(buf);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  if (size == 0) {
+    return 0;
+  }
+
+  size_t buf_size = data[0];
+  LocalFuzz<1>(data + 1, size - 1, buf_size);
+  LocalFuzz<2>(data + 1, size - 1, buf_size);
+  return 0;
+}
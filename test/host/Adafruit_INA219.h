@@ -0,0 +1,5 @@
+#pragma once
+/* Host fake: declarations only, enough for common.h to compile */
+#include "Wire.h"
+#define INA219_ADDRESS 0x40
+class Adafruit_INA219 { public: Adafruit_INA219(uint8_t addr = INA219_ADDRESS); bool begin(TwoWire *w = &Wire); float getShuntVoltage_mV(); float getBusVoltage_V(); float getCurrent_mA(); float getPower_mW(); void setCalibration_32V_2A(); void setCalibration_32V_1A(); void setCalibration_16V_400mA(); bool success(); };
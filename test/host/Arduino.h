@@ -0,0 +1,133 @@
+#pragma once
+/*
+ * Host fake of the Arduino-ESP32 core, force included like the Arduino
+ * build does. Mostly declarations so firmware sources compile; only what a
+ * host test links against is defined, in host_fakes.cpp.
+ */
+#include <math.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <string>
+typedef uint8_t byte;
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLDOWN 2
+#define INPUT_PULLUP 3
+#define RISING 1
+#define FALLING 2
+#define CHANGE 3
+#define IRAM_ATTR
+#define PROGMEM
+#define log_i(fmt, ...) printf(fmt "\n", ##__VA_ARGS__)
+#define log_e(fmt, ...) fprintf(stderr, fmt "\n", ##__VA_ARGS__)
+#define log_w(fmt, ...) fprintf(stderr, fmt "\n", ##__VA_ARGS__)
+#define log_d(...) do {} while (0)
+#define log_v(...) do {} while (0)
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t);
+void delayMicroseconds(uint32_t);
+void pinMode(uint8_t, uint8_t);
+int digitalRead(uint8_t);
+void digitalWrite(uint8_t, uint8_t);
+void attachInterrupt(uint8_t, void (*)(void), int);
+void attachInterruptArg(uint8_t, void (*)(void*), void*, int);
+void detachInterrupt(uint8_t);
+#define digitalPinToInterrupt(p) (p)
+int64_t esp_timer_get_time();
+class String {
+ public:
+  String(const char *s = "") : s_(s) {}
+  String(const std::string &s) : s_(s) {}
+  String(int v) : s_(std::to_string(v)) {}
+  String(unsigned v) : s_(std::to_string(v)) {}
+  String(long v) : s_(std::to_string(v)) {}
+  String(unsigned long v) : s_(std::to_string(v)) {}
+  String(float v, int = 2) : s_(std::to_string(v)) {}
+  String(double v, int = 2) : s_(std::to_string(v)) {}
+  String(const char *d, size_t l) : s_(d, l) {}
+  String(const uint8_t *d, size_t l) : s_((const char*)d, l) {}
+  const char *c_str() const { return s_.c_str(); }
+  size_t length() const { return s_.size(); }
+  int indexOf(char c) const { return (int)s_.find(c); }
+  String substring(size_t a) const { return String(s_.substr(a)); }
+  long toInt() const { return atol(s_.c_str()); }
+  String operator+(const String &o) const { return String(s_ + o.s_); }
+  friend String operator+(const char *a, const String &b) { return String(std::string(a) + b.s_); }
+  bool operator!=(const String &o) const { return s_ != o.s_; }
+  bool operator==(const String &o) const { return s_ == o.s_; }
+ private:
+  std::string s_;
+};
+class HardwareSerial { public: void begin(unsigned long); size_t write(const uint8_t*, size_t); size_t print(const char*); size_t println(const char* = ""); size_t print(float); };
+extern HardwareSerial Serial;
+class EspClass { public: void restart(); };
+extern EspClass ESP;
+/* FreeRTOS */
+typedef void *QueueHandle_t;
+typedef void *TaskHandle_t;
+typedef void *SemaphoreHandle_t;
+typedef void *TimerHandle_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+typedef struct { volatile uint32_t owner; uint32_t count; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0, 0}
+#define portENTER_CRITICAL(m) (void)(m)
+#define portEXIT_CRITICAL(m) (void)(m)
+#define portENTER_CRITICAL_ISR(m) (void)(m)
+#define portEXIT_CRITICAL_ISR(m) (void)(m)
+#define portYIELD_FROM_ISR(x) (void)(x)
+#define portMAX_DELAY 0xFFFFFFFF
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(x) ((TickType_t)(x))
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define eSetBits 1
+#define eIncrement 2
+#define eNoAction 0
+QueueHandle_t xQueueCreate(UBaseType_t, UBaseType_t);
+BaseType_t xQueueSend(QueueHandle_t, const void*, TickType_t);
+BaseType_t xQueueSendFromISR(QueueHandle_t, const void*, BaseType_t*);
+BaseType_t xQueueReceive(QueueHandle_t, void*, TickType_t);
+BaseType_t xQueueOverwrite(QueueHandle_t, const void*);
+BaseType_t xTaskCreate(void (*)(void*), const char*, uint32_t, void*, UBaseType_t, TaskHandle_t*);
+void vTaskDelay(TickType_t);
+void vTaskDelayUntil(TickType_t*, TickType_t);
+void vTaskDelete(TaskHandle_t);
+TickType_t xTaskGetTickCount();
+TaskHandle_t xTaskGetCurrentTaskHandle();
+BaseType_t xTaskNotifyGive(TaskHandle_t);
+void vTaskNotifyGiveFromISR(TaskHandle_t, BaseType_t*);
+uint32_t ulTaskNotifyTake(BaseType_t, TickType_t);
+BaseType_t xTaskNotify(TaskHandle_t, uint32_t, int);
+BaseType_t xTaskNotifyFromISR(TaskHandle_t, uint32_t, int, BaseType_t*);
+BaseType_t xTaskNotifyWait(uint32_t, uint32_t, uint32_t*, TickType_t);
+SemaphoreHandle_t xSemaphoreCreateMutex();
+SemaphoreHandle_t xSemaphoreCreateBinary();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t);
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_TIMEOUT 0x107
+#define ESP_ERROR_CHECK(x) (void)(x)
+#define ESP_INTR_FLAG_SHARED 0
+#define ESP_INTR_FLAG_IRAM 0
+const char *esp_err_to_name(esp_err_t);
+void *heap_caps_malloc(size_t, uint32_t);
+#define MALLOC_CAP_SPIRAM 1
+#define MALLOC_CAP_8BIT 2
+#define MALLOC_CAP_DEFAULT 4
+bool psramFound();
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+#include <algorithm>
+using std::min;
+using std::max;
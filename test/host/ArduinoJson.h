@@ -0,0 +1,11 @@
+#pragma once
+/* Host fake: declarations only, enough for common.h to compile */
+#include "Arduino.h"
+struct JsonVariant { template<class T> T as() const; template<class T> bool is() const; JsonVariant operator[](const char*) const; bool isNull() const; template<class T> JsonVariant& operator=(const T&); template<class T> operator T() const; };
+struct JsonDocument { JsonVariant operator[](const char*); };
+struct DeserializationError { enum Code { Ok }; DeserializationError(Code c = Ok); bool operator==(Code) const; friend bool operator==(Code, const DeserializationError&); bool operator!=(Code) const; const char *c_str() const; explicit operator bool() const; };
+DeserializationError deserializeJson(JsonDocument&, const uint8_t*, size_t);
+DeserializationError deserializeJson(JsonDocument&, const char*, size_t);
+size_t serializeJson(const JsonDocument&, char*, size_t);
+template<class T> T operator|(const JsonVariant&, const T&);
+inline const char *operator|(const JsonVariant&, const char *d) { return d; }
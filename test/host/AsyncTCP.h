@@ -0,0 +1,13 @@
+#pragma once
+/* Host fake: declarations only, enough for common.h to compile */
+#include "IPAddress.h"
+#include <functional>
+class AsyncClient;
+typedef std::function<void(void*, AsyncClient*)> AcConnectHandler;
+typedef std::function<void(void*, AsyncClient*, size_t, uint32_t)> AcAckHandler;
+typedef std::function<void(void*, AsyncClient*, void*, size_t)> AcDataHandler;
+typedef std::function<void(void*, AsyncClient*, uint32_t)> AcTimeoutHandler;
+typedef std::function<void(void*, AsyncClient*, int8_t)> AcErrorHandler;
+#define ASYNC_WRITE_FLAG_COPY 1
+class AsyncClient { public: void onDisconnect(AcConnectHandler, void *arg = 0); void onData(AcDataHandler, void *arg = 0); void onAck(AcAckHandler, void *arg = 0); void onPoll(AcConnectHandler, void *arg = 0); void onError(AcErrorHandler, void *arg = 0); void onTimeout(AcTimeoutHandler, void *arg = 0); size_t write(const char*); size_t write(const char*, size_t, uint8_t f = ASYNC_WRITE_FLAG_COPY); size_t add(const char*, size_t, uint8_t f = ASYNC_WRITE_FLAG_COPY); bool send(); size_t space(); bool canSend(); void close(bool now = false); IPAddress remoteIP(); uint16_t localPort(); uint16_t remotePort(); bool connected(); void setNoDelay(bool); void setRxTimeout(uint32_t); void ackLater(); size_t ack(size_t); };
+class AsyncServer { public: AsyncServer(uint16_t); void onClient(AcConnectHandler, void*); void begin(); };
@@ -0,0 +1,6 @@
+#pragma once
+/* Host fake: declarations only, enough for common.h to compile */
+#include "IPAddress.h"
+#include <functional>
+class AsyncUDPPacket { public: uint8_t *data(); size_t length(); IPAddress localIP(); IPAddress remoteIP(); };
+class AsyncUDP { public: void onPacket(std::function<void(AsyncUDPPacket)>); bool listen(uint16_t); size_t writeTo(const uint8_t*, size_t, const IPAddress&, uint16_t); };
@@ -0,0 +1,4 @@
+#pragma once
+/* Host fake: declarations only, enough for common.h to compile */
+#include "Arduino.h"
+class IPAddress { public: String toString() const; uint8_t operator[](int) const; operator uint32_t() const; };
@@ -0,0 +1,40 @@
+#pragma once
+/*
+ * Host fake of the ESP32 Preferences (NVS) library. Keys live in memory
+ * and every call is counted, so tests can tell how often firmware goes to
+ * NVS. Values survive end()/begin() like on the device.
+ */
+#include "Arduino.h"
+
+typedef struct {
+  uint32_t begins;        //Namespace opens, the expensive part on the device
+  uint32_t reads;
+  uint32_t writes;        //Each put is one NVS commit
+} PreferencesStats_st;
+
+class Preferences {
+public:
+  bool begin(const char *name, bool readOnly = false);
+  void end();
+  int32_t getInt(const char *key, int32_t defaultValue = 0);
+  size_t putInt(const char *key, int32_t value);
+  uint8_t getUChar(const char *key, uint8_t defaultValue = 0);
+  size_t putUChar(const char *key, uint8_t value);
+  uint16_t getUShort(const char *key, uint16_t defaultValue = 0);
+  size_t putUShort(const char *key, uint16_t value);
+  uint32_t getUInt(const char *key, uint32_t defaultValue = 0);
+  size_t putUInt(const char *key, uint32_t value);
+  float getFloat(const char *key, float defaultValue = 0);
+  size_t putFloat(const char *key, float value);
+  String getString(const char *key, const String &defaultValue = String());
+  size_t putString(const char *key, const String &value);
+  size_t getBytes(const char *key, void *buf, size_t maxLen);
+  size_t putBytes(const char *key, const void *value, size_t len);
+  size_t getBytesLength(const char *key);
+  bool isKey(const char *key);
+  bool remove(const char *key);
+
+  /* Host only */
+  static PreferencesStats_st stats;
+  static void Clear();
+};
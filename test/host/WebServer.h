@@ -0,0 +1,6 @@
+#pragma once
+/* Host fake: declarations only, enough for common.h to compile */
+#include "Arduino.h"
+#include <functional>
+#define HTTP_POST 1
+class WebServer { public: WebServer(int); void on(const char*, std::function<void()>); void on(const char*, int, std::function<void()>); void send(int, const char*, const char*); String arg(const char*); void begin(); void handleClient(); };
@@ -0,0 +1,12 @@
+#pragma once
+/* Host fake: declarations only, enough for common.h to compile */
+#include "Arduino.h"
+#include "IPAddress.h"
+typedef enum { WIFI_STA = 1, WIFI_AP = 2 } wifi_mode_t;
+typedef enum { WL_CONNECTED = 3 } wl_status_t;
+typedef enum { WIFI_IF_STA = 0, WIFI_IF_AP } wifi_interface_t;
+struct STAClass { bool started(); };
+class WiFiClass { public: STAClass STA; bool mode(wifi_mode_t); wifi_mode_t getMode(); bool setChannel(uint8_t); int32_t channel(); const uint8_t *macAddress(); void begin(const String&, const String&); wl_status_t status(); bool softAP(const char*, const char*, int); IPAddress softAPIP(); IPAddress localIP(); };
+extern WiFiClass WiFi;
+#define MACSTR "%02x:%02x:%02x:%02x:%02x:%02x"
+#define MAC2STR(a) (a)[0], (a)[1], (a)[2], (a)[3], (a)[4], (a)[5]
@@ -0,0 +1,5 @@
+#pragma once
+/* Host fake: declarations only, enough for common.h to compile */
+#include "Arduino.h"
+class TwoWire { public: bool setPins(int, int); bool begin(); void setClock(uint32_t); void beginTransmission(uint8_t); size_t write(uint8_t); uint8_t endTransmission(bool stop = true); size_t requestFrom(uint8_t, size_t, bool stop = true); int read(); int available(); };
+extern TwoWire Wire;
@@ -0,0 +1,2 @@
+#pragma once
+/* Host fake: declarations only, enough for common.h to compile */
@@ -0,0 +1,17 @@
+#pragma once
+/* Host fake: declarations only, enough for common.h to compile */
+#include "Arduino.h"
+#define ESP_NOW_ETH_ALEN 6
+#define ESP_NOW_MAX_DATA_LEN 250
+typedef struct { uint8_t *src_addr; uint8_t *des_addr; void *rx_ctrl; } esp_now_recv_info_t;
+typedef struct { uint8_t *des_addr; } esp_now_send_info_t;
+typedef enum { ESP_NOW_SEND_SUCCESS = 0, ESP_NOW_SEND_FAIL } esp_now_send_status_t;
+typedef struct { uint8_t peer_addr[6]; uint8_t lmk[16]; uint8_t channel; int ifidx; bool encrypt; void *priv; } esp_now_peer_info_t;
+enum { ESP_ERR_ESPNOW_NOT_INIT = 0x3066, ESP_ERR_ESPNOW_ARG, ESP_ERR_ESPNOW_NO_MEM, ESP_ERR_ESPNOW_FULL, ESP_ERR_ESPNOW_NOT_FOUND, ESP_ERR_ESPNOW_INTERNAL, ESP_ERR_ESPNOW_EXIST };
+esp_err_t esp_now_init();
+esp_err_t esp_now_register_recv_cb(void (*)(const esp_now_recv_info_t*, const uint8_t*, int));
+esp_err_t esp_now_register_send_cb(void (*)(const esp_now_send_info_t*, esp_now_send_status_t));
+esp_err_t esp_now_add_peer(const esp_now_peer_info_t*);
+esp_err_t esp_now_mod_peer(const esp_now_peer_info_t*);
+bool esp_now_is_peer_exist(const uint8_t*);
+esp_err_t esp_now_send(const uint8_t*, const uint8_t*, size_t);
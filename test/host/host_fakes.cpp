@@ -0,0 +1,137 @@
+/*
+ * Definitions behind the host fakes that tests link against: an in memory
+ * Preferences store and FreeRTOS mutexes on std::mutex.
+ */
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Preferences.h"
+
+typedef std::map<std::string, std::vector<uint8_t>> NvsNamespace_t;
+
+static std::map<std::string, NvsNamespace_t> _nvs;
+static NvsNamespace_t *_open = nullptr;
+
+PreferencesStats_st Preferences::stats = { 0, 0, 0 };
+
+void Preferences::Clear()
+{
+  _nvs.clear();
+  stats = { 0, 0, 0 };
+}
+
+bool Preferences::begin(const char *name, bool)
+{
+  stats.begins++;
+  _open = &_nvs[name];
+  return true;
+}
+
+void Preferences::end()
+{
+  _open = nullptr;
+}
+
+static const std::vector<uint8_t> *LocalGet(const char *key)
+{
+  Preferences::stats.reads++;
+  if (_open == nullptr) {
+    return nullptr;
+  }
+  auto it = _open->find(key);
+  return (it == _open->end()) ? nullptr : &it->second;
+}
+
+static size_t LocalPut(const char *key, const void *value, size_t len)
+{
+  Preferences::stats.writes++;
+  if (_open == nullptr) {
+    return 0;
+  }
+  (*_open)[key].assign((const uint8_t *)value, (const uint8_t *)value + len);
+  return len;
+}
+
+template <class T>
+static T LocalGetValue(const char *key, T defaultValue)
+{
+  const std::vector<uint8_t> *v = LocalGet(key);
+  if (v == nullptr || v->size() != sizeof(T)) {
+    return defaultValue;
+  }
+  T value;
+  memcpy(&value, v->data(), sizeof(T));
+  return value;
+}
+
+int32_t Preferences::getInt(const char *key, int32_t d) { return LocalGetValue(key, d); }
+size_t Preferences::putInt(const char *key, int32_t v) { return LocalPut(key, &v, sizeof(v)); }
+uint8_t Preferences::getUChar(const char *key, uint8_t d) { return LocalGetValue(key, d); }
+size_t Preferences::putUChar(const char *key, uint8_t v) { return LocalPut(key, &v, sizeof(v)); }
+uint16_t Preferences::getUShort(const char *key, uint16_t d) { return LocalGetValue(key, d); }
+size_t Preferences::putUShort(const char *key, uint16_t v) { return LocalPut(key, &v, sizeof(v)); }
+uint32_t Preferences::getUInt(const char *key, uint32_t d) { return LocalGetValue(key, d); }
+size_t Preferences::putUInt(const char *key, uint32_t v) { return LocalPut(key, &v, sizeof(v)); }
+float Preferences::getFloat(const char *key, float d) { return LocalGetValue(key, d); }
+size_t Preferences::putFloat(const char *key, float v) { return LocalPut(key, &v, sizeof(v)); }
+
+String Preferences::getString(const char *key, const String &d)
+{
+  const std::vector<uint8_t> *v = LocalGet(key);
+  return v ? String((const char *)v->data(), v->size()) : d;
+}
+
+size_t Preferences::putString(const char *key, const String &v)
+{
+  return LocalPut(key, v.c_str(), v.length());
+}
+
+size_t Preferences::getBytes(const char *key, void *buf, size_t maxLen)
+{
+  const std::vector<uint8_t> *v = LocalGet(key);
+  if (v == nullptr || v->size() > maxLen) {
+    return 0;
+  }
+  memcpy(buf, v->data(), v->size());
+  return v->size();
+}
+
+size_t Preferences::putBytes(const char *key, const void *value, size_t len)
+{
+  return LocalPut(key, value, len);
+}
+
+size_t Preferences::getBytesLength(const char *key)
+{
+  const std::vector<uint8_t> *v = LocalGet(key);
+  return v ? v->size() : 0;
+}
+
+bool Preferences::isKey(const char *key)
+{
+  return LocalGet(key) != nullptr;
+}
+
+bool Preferences::remove(const char *key)
+{
+  stats.writes++;
+  return _open && _open->erase(key) > 0;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+  return new std::mutex();
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t)
+{
+  ((std::mutex *)sem)->lock();
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+  ((std::mutex *)sem)->unlock();
+  return pdTRUE;
+}
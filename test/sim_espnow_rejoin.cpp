@@ -0,0 +1,206 @@
+/*
+ * ESP-NOW rejoin simulation: how long a slave takes to find the master's
+ * channel after a reboot, with ESPNOW_DiscoverChannel() from
+ * espnow_discovery.h against the scan it replaced (one DISCOVER per channel,
+ * 2000 ms on each, channels in order from the cached one).
+ *
+ * Both run against the same model of a radio on a virtual clock: channel
+ * switches cost time, probes and replies get lost, replies take a while,
+ * and the 2.4 GHz channels overlap so a probe sometimes reaches the master
+ * from the channel next to it.
+ *
+ *   sim_espnow_rejoin [trials]
+ *
+ * Prints p50/p90/p99/max per scenario. Exits non zero if the new discovery
+ * is slower than the old scan anywhere, or takes more than one sweep at the
+ * shortest dwell when nothing is lost.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+#include "espnow_discovery.h"
+
+#define SIM_SWITCH_MS                         5       //WiFi.setChannel() plus the peer update
+#define SIM_LATENCY_MIN_MS                    2       //Probe out, master's task, reply back
+#define SIM_LATENCY_MAX_MS                    15
+#define SIM_OLD_DWELL_MS                      2000    //delay() in the old WIRELESS_ChannelDiscoverLoop()
+
+typedef struct {
+  const char *name;
+  bool moved;           //Master is no longer on the cached channel
+  double loss;          //Per frame, probe and reply each
+  double leak;          //A probe one channel off still reaching the master
+} Scenario_st;
+
+static uint32_t _seed = 1;
+
+static double LocalRandom()
+{
+  _seed = _seed * 1103515245 + 12345;
+  return (double)((_seed >> 8) & 0xFFFFFF) / 0x1000000;
+}
+
+static uint8_t LocalRandomChannel()
+{
+  return ESPNOW_CHANNEL_MIN + (uint8_t)(LocalRandom() * ESPNOW_CHANNEL_COUNT);
+}
+
+/* Routers mostly sit on 1, 6 or 11 */
+static uint8_t LocalRouterChannel()
+{
+  static const uint8_t preferred[] = { 1, 6, 11 };
+  if (LocalRandom() < 0.7) {
+    return preferred[(int)(LocalRandom() * 3)];
+  }
+  return LocalRandomChannel();
+}
+
+/* The RADIO of espnow_discovery.h on a virtual clock */
+class SimRadio
+{
+public:
+  SimRadio(const Scenario_st *scenario, uint8_t master) : _scenario(scenario), _master(master) {}
+
+  uint32_t now_ms = 0;
+
+  void SetChannel(uint8_t chn)
+  {
+    _channel = chn;
+    _replyAt = 0;         //A reply on its way is missed once the radio has moved
+    now_ms += SIM_SWITCH_MS;
+  }
+
+  void SendProbe()
+  {
+    int off = abs((int)_channel - (int)_master);
+    bool heard = (off == 0) || (off == 1 && LocalRandom() < _scenario->leak);
+    if ( ! heard || LocalRandom() < _scenario->loss || LocalRandom() < _scenario->loss) {
+      return;
+    }
+
+    uint32_t at = now_ms + SIM_LATENCY_MIN_MS +
+                  (uint32_t)(LocalRandom() * (SIM_LATENCY_MAX_MS - SIM_LATENCY_MIN_MS));
+    if (_replyAt == 0 || at < _replyAt) {
+      _replyAt = at;
+    }
+  }
+
+  uint8_t WaitReply(uint16_t ms)
+  {
+    if (_replyAt != 0 && _replyAt <= now_ms + ms) {
+      now_ms = std::max(now_ms, _replyAt);
+      _replyAt = 0;
+      return _master;
+    }
+    now_ms += ms;
+    return 0;
+  }
+
+  uint8_t Channel() const { return _channel; }
+
+private:
+  const Scenario_st *_scenario;
+  uint8_t _master;
+  uint8_t _channel = 0;
+  uint32_t _replyAt = 0;
+};
+
+/* The loop ESPNOW_DiscoverChannel() replaced */
+static uint8_t LocalOldDiscover(SimRadio &radio, uint8_t cached)
+{
+  uint8_t chn = cached;
+
+  while (1) {
+    radio.SetChannel(chn);
+    radio.SendProbe();
+
+    uint32_t start = radio.now_ms;
+    uint8_t reply = radio.WaitReply(SIM_OLD_DWELL_MS);
+    radio.now_ms = start + SIM_OLD_DWELL_MS;
+    if (reply != 0) {
+      if (reply != chn) {
+        radio.SetChannel(reply);
+      }
+      return reply;
+    }
+
+    chn++;
+    if (chn > ESPNOW_CHANNEL_MAX) {
+      chn = ESPNOW_CHANNEL_MIN;
+    }
+  }
+}
+
+typedef struct {
+  uint32_t p50, p90, p99, max;
+} Stats_st;
+
+static Stats_st LocalStats(std::vector<uint32_t> &ms)
+{
+  std::sort(ms.begin(), ms.end());
+  auto at = [&](double q) { return ms[(size_t)(q * (ms.size() - 1))]; };
+  return { at(0.50), at(0.90), at(0.99), ms.back() };
+}
+
+int main(int argc, char **argv)
+{
+  unsigned trials = (argc > 1) ? strtoul(argv[1], NULL, 10) : 20000;
+
+  const Scenario_st scenarios[] = {
+    { "cached hit",         false, 0.0,  0.0 },
+    { "cached hit, lossy",  false, 0.3,  0.0 },
+    { "master moved",       true,  0.0,  0.3 },
+    { "moved, lossy",       true,  0.3,  0.3 },
+    { "moved, very lossy",  true,  0.6,  0.3 },
+  };
+
+  /* Nothing lost: the first sweep at the shortest dwell finds it */
+  const uint32_t sweep_ms = ESPNOW_CHANNEL_COUNT * (SIM_SWITCH_MS + ESPNOW_DWELL_MIN_MS) + SIM_SWITCH_MS;
+  int failed = 0;
+
+  printf("%-18s %-4s %8s %8s %8s %8s  (ms)\n", "scenario", "", "p50", "p90", "p99", "max");
+  for (const Scenario_st &s : scenarios) {
+    std::vector<uint32_t> old_ms, new_ms;
+
+    for (unsigned t = 0; t < trials; t++) {
+      uint8_t master = LocalRouterChannel();
+      uint8_t cached = master;
+      while (s.moved && cached == master) {
+        cached = LocalRandomChannel();
+      }
+
+      SimRadio old_radio(&s, master);
+      if (LocalOldDiscover(old_radio, cached) != master || old_radio.Channel() != master) {
+        fprintf(stderr, "FAIL: %s: old scan settled off the master's channel\n", s.name);
+        return 1;
+      }
+      old_ms.push_back(old_radio.now_ms);
+
+      SimRadio new_radio(&s, master);
+      uint16_t visits;
+      if (ESPNOW_DiscoverChannel(new_radio, cached, &visits) != master || new_radio.Channel() != master) {
+        fprintf(stderr, "FAIL: %s: discovery settled off the master's channel\n", s.name);
+        return 1;
+      }
+      new_ms.push_back(new_radio.now_ms);
+    }
+
+    Stats_st o = LocalStats(old_ms);
+    Stats_st n = LocalStats(new_ms);
+    printf("%-18s %-4s %8u %8u %8u %8u\n", s.name, "old", o.p50, o.p90, o.p99, o.max);
+    printf("%-18s %-4s %8u %8u %8u %8u\n", "", "new", n.p50, n.p90, n.p99, n.max);
+
+    if (n.p50 > o.p50 || n.p90 > o.p90 || n.p99 > o.p99) {
+      fprintf(stderr, "FAIL: %s: discovery slower than the old scan\n", s.name);
+      failed = 1;
+    }
+    if (s.loss == 0.0 && n.max > sweep_ms) {
+      fprintf(stderr, "FAIL: %s: %u ms without loss, one sweep is %u ms\n", s.name, n.max, sweep_ms);
+      failed = 1;
+    }
+  }
+
+  return failed;
+}
@@ -0,0 +1,272 @@
+/*
+ * Snapshot stream vectors for the round trip against the server's decoder
+ * (test_snapshot_roundtrip.js). Frames are packed with snapshot_frame.h the
+ * way dev_mng.cpp and history.cpp pack them and written to stdout as one
+ * JSON object:
+ *
+ *   { "stream": hex of every frame back to back, with junk and a corrupted frame in between,
+ *     "frames": what the decoder must hand back for each frame that survives }
+ *
+ * A live frame's expectation is its seq and [id, flags, mA*10, mV, age ms]
+ * per device with absolute values, or null when it must be dropped for a
+ * missing keyframe. A history frame's is its id, tier, timestamp and
+ * [ts s, mA, mV] per sample.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "snapshot_frame.h"
+
+#define VECTORS_RECORD_MAX        0xFF    //Same as DEVICE_PACKED_RECORD_MAX and HISTORY_REPLY_RECORD_MAX
+#define VECTORS_FRAME_MAX         8192
+#define VECTORS_REC_UNKNOWN       0x7F    //No such record type, readers skip it
+
+typedef enum {
+  VECTOR_EXPECT_DEVICES = (0),  //Decoded against the keyframe base
+  VECTOR_EXPECT_DROPPED,        //Decoded, but no keyframe to apply the deltas to
+  VECTOR_EXPECT_NOTHING,        //Corrupted on the wire, never decoded
+} VectorExpect_e;
+
+typedef struct {
+  uint8_t id;
+  uint8_t flags;
+  int32_t mA;
+  int32_t mV;
+  uint32_t age_ms;
+} VectorDevice_st;
+
+typedef struct {
+  uint32_t ts_s;
+  int32_t mA;
+  uint32_t mV;
+} VectorSample_st;
+
+static std::vector<uint8_t> _stream;
+static std::string _frames;
+static int _failures = 0;
+
+/* Keyframe values the deltas are taken against, as dev_mng.cpp keeps them */
+static int32_t _keyframemA[256];
+static int32_t _keyframemV[256];
+static bool _inKeyframe[256];
+
+static uint32_t _seed = 1;
+
+static uint32_t LocalRandom()
+{
+  _seed ^= _seed << 13;
+  _seed ^= _seed >> 17;
+  _seed ^= _seed << 5;
+  return _seed;
+}
+
+static void LocalExpect(const std::string &frame)
+{
+  _frames += _frames.empty() ? "\n    " : ",\n    ";
+  _frames += frame;
+}
+
+static void LocalEmit(const uint8_t *frame, size_t len)
+{
+  if (len == 0) {
+    fprintf(stderr, "FAIL: frame did not fit\n");
+    _failures++;
+    return;
+  }
+  _stream.insert(_stream.end(), frame, frame + len);
+}
+
+/* devices hold absolute values, deltas are packed for the ones the keyframe base has */
+static void LocalLive(uint16_t seq, bool keyframe, uint16_t base_seq, const std::vector<VectorDevice_st> &devices,
+                      VectorExpect_e result, bool unknown_record = false)
+{
+  static uint8_t packet[VECTORS_FRAME_MAX];
+  SnapshotWriter writer(packet, sizeof(packet));
+  uint8_t record[VECTORS_RECORD_MAX];
+  size_t recordLen = 0;
+  std::string expect;
+
+  writer.Begin(seq, keyframe? SNAPSHOT_FLAG_KEYFRAME : 0);
+  writer.AddU32(SNAPSHOT_REC_TIMESTAMP, 123456789);
+  if (unknown_record) {
+    const uint8_t junk[] = { 'L', 'K', SNAPSHOT_VERSION, 0x00, 0xFF };
+    writer.Add(VECTORS_REC_UNKNOWN, junk, sizeof(junk));
+  }
+  if (keyframe) {
+    for (size_t i = 0; i < 256; i++) {
+      _inKeyframe[i] = false;
+    }
+  } else {
+    writer.AddU16(SNAPSHOT_REC_BASE_SEQ, base_seq);
+  }
+
+  for (const VectorDevice_st &d : devices) {
+    SnapshotPackedDevice_st dev = { d.id, d.flags, d.mA, d.mV, d.age_ms };
+    bool decoded = true;
+
+    if (keyframe) {
+      _keyframemA[d.id] = d.mA;
+      _keyframemV[d.id] = d.mV;
+      _inKeyframe[d.id] = true;
+    } else if (_inKeyframe[d.id]) {
+      dev.mA -= _keyframemA[d.id];
+      dev.mV -= _keyframemV[d.id];
+    } else if ( ! (d.flags & SNAPSHOT_PACKED_ABSOLUTE)) {
+      /* A delta with no base: the decoder must leave the device out */
+      dev.mA = 1;
+      decoded = false;
+    }
+
+    if (recordLen + SNAPSHOT_PACKED_DEVICE_MAX > sizeof(record)) {
+      writer.Add(SNAPSHOT_REC_DEVICES_PACKED, record, recordLen);
+      recordLen = 0;
+    }
+    recordLen += SNAPSHOT_PackDevice(&record[recordLen], &dev);
+
+    if (decoded) {
+      char entry[96];
+      snprintf(entry, sizeof(entry), "%s[%u, %u, %d, %d, %u]", expect.empty() ? "" : ", ",
+               d.id, d.flags, d.mA, d.mV, d.age_ms);
+      expect += entry;
+    }
+  }
+  if (recordLen) {
+    writer.Add(SNAPSHOT_REC_DEVICES_PACKED, record, recordLen);
+  }
+
+  LocalEmit(packet, writer.Finish());
+
+  if (result != VECTOR_EXPECT_NOTHING) {
+    char head[64];
+    snprintf(head, sizeof(head), "{ \"seq\": %u, \"devices\": ", seq);
+    LocalExpect(head + (result == VECTOR_EXPECT_DROPPED ? std::string("null") : "[" + expect + "]") + " }");
+  }
+}
+
+static void LocalHistory(uint8_t id, uint8_t tier, const std::vector<VectorSample_st> &samples)
+{
+  static uint8_t packet[VECTORS_FRAME_MAX];
+  SnapshotWriter writer(packet, sizeof(packet));
+  const uint32_t now_ms = 987654321;
+  const uint8_t query[10] = { id, tier, 0, 0, 0, 0, 0xFF, 0xFF, 0xFF, 0xFF };
+
+  writer.Begin(0, SNAPSHOT_FLAG_HISTORY);
+  writer.AddU32(SNAPSHOT_REC_TIMESTAMP, now_ms);
+  writer.Add(SNAPSHOT_REC_HISTORY_QUERY, query, sizeof(query));
+
+  uint8_t record[VECTORS_RECORD_MAX];
+  size_t recordLen = 0;
+  uint32_t prevTs = 0;
+  std::string expect;
+  for (const VectorSample_st &s : samples) {
+    if (recordLen + SNAPSHOT_HISTORY_SAMPLE_MAX > sizeof(record)) {
+      writer.Add(SNAPSHOT_REC_HISTORY_SAMPLES, record, recordLen);
+      recordLen = 0;
+    }
+    recordLen += SNAPSHOT_PutVarint(&record[recordLen], s.ts_s - prevTs);
+    recordLen += SNAPSHOT_PutVarint(&record[recordLen], SNAPSHOT_ZigZag(s.mA));
+    recordLen += SNAPSHOT_PutVarint(&record[recordLen], s.mV);
+    prevTs = s.ts_s;
+
+    char entry[64];
+    snprintf(entry, sizeof(entry), "%s[%u, %d, %u]", expect.empty() ? "" : ", ", s.ts_s, s.mA, s.mV);
+    expect += entry;
+  }
+  if (recordLen) {
+    writer.Add(SNAPSHOT_REC_HISTORY_SAMPLES, record, recordLen);
+  }
+
+  LocalEmit(packet, writer.Finish());
+
+  char head[128];
+  snprintf(head, sizeof(head), "{ \"history\": { \"id\": %u, \"tier\": %u, \"now_ms\": %u, \"samples\": ", id, tier, now_ms);
+  LocalExpect(head + ("[" + expect + "]") + " } }");
+}
+
+static VectorDevice_st LocalRandomDevice(uint8_t id)
+{
+  uint8_t flags = 0;
+  if (LocalRandom() & 1) {
+    flags |= SNAPSHOT_PACKED_ALARM_VALID | (LocalRandom() & (SNAPSHOT_PACKED_SMOKE | SNAPSHOT_PACKED_FIRE));
+  }
+  if (LocalRandom() & 1) {
+    flags |= SNAPSHOT_PACKED_CHARGE_VALID | ((LocalRandom() << SNAPSHOT_PACKED_CHARGE_SHIFT) & SNAPSHOT_PACKED_CHARGE_MASK);
+  }
+  /* Anything the INA219 can report: +-3.2 A and 0..26 V */
+  return { id, flags, (int32_t)(LocalRandom() % 64001) - 32000, (int32_t)(LocalRandom() % 26001), LocalRandom() % 60000 };
+}
+
+int main()
+{
+  /* Writer edge cases first: nothing fits in a buffer smaller than the overhead */
+  uint8_t tiny[SNAPSHOT_OVERHEAD + 3];
+  SnapshotWriter small(tiny, sizeof(tiny));
+  small.Begin(1, 0);
+  if (small.AddU32(SNAPSHOT_REC_TIMESTAMP, 0) || small.Finish() != 0) {
+    fprintf(stderr, "FAIL: overflowing record accepted\n");
+    _failures++;
+  }
+
+  /* Keyframe with the varint extremes and a record type the decoder doesn't know */
+  std::vector<VectorDevice_st> devices = {
+    { 1, SNAPSHOT_PACKED_ALARM_VALID | SNAPSHOT_PACKED_SMOKE, 12345, 12000, 0 },
+    { 2, SNAPSHOT_PACKED_CHARGE_VALID | (2 << SNAPSHOT_PACKED_CHARGE_SHIFT), -57, 0, 250 },
+    { 3, SNAPSHOT_PACKED_ALARM_VALID | SNAPSHOT_PACKED_FIRE, 0, 5000, 1999 },
+    { 255, 0, INT32_MIN, INT32_MAX, UINT32_MAX },
+  };
+  LocalLive(10, true, 0, devices, VECTOR_EXPECT_DEVICES, true);
+
+  /* Deltas, a device new since the keyframe and one the decoder has no base for */
+  std::vector<VectorDevice_st> deltas = {
+    { 1, SNAPSHOT_PACKED_ALARM_VALID, 12000, 12012, 100 },
+    { 2, SNAPSHOT_PACKED_CHARGE_VALID | (1 << SNAPSHOT_PACKED_CHARGE_SHIFT), 300, -1, 350 },
+    { 7, SNAPSHOT_PACKED_ABSOLUTE, 500, 3300, 20 },
+    { 9, 0, 0, 0, 0 },
+  };
+  LocalLive(11, false, 10, deltas, VECTOR_EXPECT_DEVICES);
+
+  /* The same frame with a flipped bit is dropped on its CRC, junk and a torn magic are skipped */
+  size_t start = _stream.size();
+  LocalLive(11, false, 10, deltas, VECTOR_EXPECT_NOTHING);
+  _stream[start + SNAPSHOT_HEADER_SIZE + 3] ^= 0x10;
+  const uint8_t junk[] = { 0x00, 'L', 'K', 0x01, 'L' };
+  _stream.insert(_stream.end(), junk, junk + sizeof(junk));
+
+  /* Deltas against a keyframe the reader never saw */
+  LocalLive(12, false, 9, deltas, VECTOR_EXPECT_DROPPED);
+
+  /* A full bus: the keyframe and its deltas span several records */
+  devices.clear();
+  for (int id = 1; id <= 200; id++) {
+    devices.push_back(LocalRandomDevice(id));
+  }
+  LocalLive(13, true, 0, devices, VECTOR_EXPECT_DEVICES);
+  for (VectorDevice_st &d : devices) {
+    d = LocalRandomDevice(d.id);
+  }
+  LocalLive(14, false, 13, devices, VECTOR_EXPECT_DEVICES);
+
+  /* History reply with sample gaps from 1 s to a day, over several records */
+  std::vector<VectorSample_st> samples;
+  uint32_t ts = 0;
+  for (int i = 0; i < 150; i++) {
+    ts += (i % 10 == 9) ? 86400 : 1 + LocalRandom() % 900;
+    samples.push_back({ ts, (int32_t)(LocalRandom() % 64001) - 32000, LocalRandom() % 26001 });
+  }
+  samples.push_back({ ts + 1, INT32_MIN, UINT32_MAX });
+  LocalHistory(5, 1, samples);
+  LocalHistory(6, 0, {});
+
+  /* An empty keyframe resets the base, deltas after it have nothing to apply to */
+  LocalLive(15, true, 0, {}, VECTOR_EXPECT_DEVICES);
+  LocalLive(16, false, 15, { { 1, 0, 10, 10, 0 } }, VECTOR_EXPECT_DEVICES);
+
+  printf("{\n  \"stream\": \"");
+  for (uint8_t b : _stream) {
+    printf("%02x", b);
+  }
+  printf("\",\n  \"frames\": [%s\n  ]\n}\n", _frames.c_str());
+
+  return _failures ? 1 : 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * RS485 framing conformance: golden frames as built by the server's
+ * buildPacket(), encode/decode round trips for every address width and
+ * payload length, and the decoder's reject paths.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "rs485_frame.h"
+
+static int _failures = 0;
+
+#define CHECK(cond) do { \
+    if ( ! (cond)) { \
+      fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+      _failures++; \
+    } \
+  } while (0)
+
+typedef Rs485Frame<1> UartCodec;
+
+/* Feeds len bytes, returns the result of the last one */
+template <class Decoder>
+static Rs485RxResult_e LocalFeed(Decoder &rx, const uint8_t *data, size_t len)
+{
+  Rs485RxResult_e result = RS485_RX_IDLE;
+  for (size_t i = 0; i < len; i++) {
+    result = rx.Feed(data[i]);
+  }
+  return result;
+}
+
+static void TestCrcCheckValue()
+{
+  const uint8_t check[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+  CHECK(CRC16_Calculate(check, sizeof(check)) == 0x4B37);
+
+  uint16_t crc = CRC16_INIT;
+  for (size_t i = 0; i < sizeof(check); i++) {
+    crc = CRC16_Update(crc, check[i]);
+  }
+  CHECK(crc == 0x4B37);
+}
+
+static void TestGoldenFrames()
+{
+  /* buildPacket(2, CMD_GET_CURRENT_mA) */
+  const uint8_t poll[] = { 0x02, 0x04, 0x02, 0x00, 0x61, 0x31, 0x03 };
+  /* buildPacket(0, CMD_SET_THRESHOLD, [300 LE, 100 LE, FIRST_ID 2, SLOT 5]) */
+  const uint8_t threshold[] = { 0x02, 0x0A, 0x00, 0x01, 0x2C, 0x01, 0x64, 0x00, 0x02, 0x05, 0xAF, 0x80, 0x03 };
+
+  uint8_t out[UartCodec::MAX_FRAME];
+  const uint8_t cmd = 0x00;
+  CHECK(UartCodec::Encode(out, sizeof(out), 2, &cmd, 1) == sizeof(poll));
+  CHECK(memcmp(out, poll, sizeof(poll)) == 0);
+
+  const uint8_t args[] = { 0x01, 0x2C, 0x01, 0x64, 0x00, 0x02, 0x05 };
+  CHECK(UartCodec::Encode(out, sizeof(out), 0, args, sizeof(args)) == sizeof(threshold));
+  CHECK(memcmp(out, threshold, sizeof(threshold)) == 0);
+
+  uint8_t buf[UartCodec::MAX_PAYLOAD];
+  UartCodec::Decoder rx;
+  rx.Attach(buf, sizeof(buf));
+  CHECK(LocalFeed(rx, threshold, sizeof(threshold)) == RS485_RX_FRAME);
+  CHECK(rx.Address() == 0);
+  CHECK(rx.PayloadLen() == sizeof(args));
+  CHECK(memcmp(buf, args, sizeof(args)) == 0);
+}
+
+template <size_t ADDR_LEN>
+static void TestRoundTrip(uint32_t addr)
+{
+  typedef Rs485Frame<ADDR_LEN> Codec;
+  uint8_t payload[Codec::MAX_PAYLOAD];
+  uint8_t frame[Codec::MAX_FRAME];
+  uint8_t buf[Codec::MAX_PAYLOAD];
+  typename Codec::Decoder rx;
+  rx.Attach(buf, sizeof(buf));
+
+  for (size_t len = 0; len <= Codec::MAX_PAYLOAD; len++) {
+    for (size_t i = 0; i < len; i++) {
+      payload[i] = (uint8_t)(i * 7 + len);
+    }
+
+    size_t frame_len = Codec::Encode(frame, sizeof(frame), addr, payload, len);
+    CHECK(frame_len == len + Codec::OVERHEAD);
+    CHECK(frame[1] == ADDR_LEN + len + 2);
+
+    /* Every byte but the last keeps the frame open */
+    for (size_t i = 0; i + 1 < frame_len; i++) {
+      CHECK(rx.Feed(frame[i]) == RS485_RX_BUSY);
+    }
+    CHECK(rx.Feed(frame[frame_len - 1]) == RS485_RX_FRAME);
+    CHECK(rx.IsIdle());
+    CHECK(rx.Address() == addr);
+    CHECK(rx.PayloadLen() == len);
+    CHECK(memcmp(buf, payload, len) == 0);
+  }
+
+  CHECK(Codec::Encode(frame, sizeof(frame), addr, payload, Codec::MAX_PAYLOAD + 1) == 0);
+  CHECK(Codec::Encode(frame, Codec::OVERHEAD, addr, payload, 1) == 0);
+}
+
+static void TestRejects()
+{
+  const uint8_t payload[] = { 0x05, 0x01, 0x02, 0x03 };
+  uint8_t frame[UartCodec::MAX_FRAME];
+  uint8_t buf[8];
+  UartCodec::Decoder rx;
+  rx.Attach(buf, sizeof(buf));
+
+  size_t len = UartCodec::Encode(frame, sizeof(frame), 7, payload, sizeof(payload));
+
+  frame[4] ^= 0x01;
+  CHECK(LocalFeed(rx, frame, len) == RS485_RX_ERR_CRC);
+  frame[4] ^= 0x01;
+
+  frame[len - 1] = 0x00;
+  CHECK(LocalFeed(rx, frame, len) == RS485_RX_ERR_ETX);
+  frame[len - 1] = RS485_FRAME_ETX;
+
+  /* LEN shorter than address + CRC */
+  const uint8_t short_len[] = { RS485_FRAME_STX, 0x02 };
+  CHECK(LocalFeed(rx, short_len, sizeof(short_len)) == RS485_RX_ERR_LEN);
+
+  /* Payload longer than the attached buffer */
+  rx.Attach(buf, 2);
+  CHECK(LocalFeed(rx, frame, 2) == RS485_RX_ERR_LEN);
+  CHECK(rx.IsIdle());
+
+  rx.Attach(NULL, 0);
+  CHECK(LocalFeed(rx, frame, 2) == RS485_RX_ERR_NO_BUFFER);
+
+  /* Noise and a truncated frame before a good one don't lose it */
+  rx.Attach(buf, sizeof(buf));
+  const uint8_t noise[] = { 0x00, 0xFF, RS485_FRAME_ETX, 0x55 };
+  CHECK(LocalFeed(rx, noise, sizeof(noise)) == RS485_RX_IDLE);
+  LocalFeed(rx, frame, len - 3);
+  rx.Reset();
+  CHECK(LocalFeed(rx, frame, len) == RS485_RX_FRAME);
+  CHECK(rx.Address() == 7);
+  CHECK(memcmp(buf, payload, sizeof(payload)) == 0);
+}
+
+int main()
+{
+  TestCrcCheckValue();
+  TestGoldenFrames();
+  TestRoundTrip<0>(0);
+  TestRoundTrip<1>(0xA5);
+  TestRoundTrip<2>(0xBEEF);
+  TestRoundTrip<4>(0xDEADBEEF);
+  TestRejects();
+
+  if (_failures) {
+    fprintf(stderr, "%d checks failed\n", _failures);
+    return 1;
+  }
+  printf("OK\n");
+  return 0;
+}
@@ -0,0 +1,52 @@
+// Snapshot round trip: frames packed by snapshot_frame.h (snapshot_vectors) through the
+// server's decoder in wired_solution/nodejs/snapshot.js, fed whole and in chunks.
+//
+//   node test_snapshot_roundtrip.js <path to snapshot_vectors>
+const assert = require('assert');
+const path = require('path');
+const { execFileSync } = require('child_process');
+const {
+  SNAPSHOT_FLAG_HISTORY, nextSnapshotFrame, decodeSnapshotDevices, decodeHistory
+} = require(path.join(__dirname, '..', 'wired_solution', 'nodejs', 'snapshot'));
+
+const vectors = JSON.parse(execFileSync(process.argv[2]).toString());
+const stream = Buffer.from(vectors.stream, 'hex');
+
+// The CRC error the corrupted frame raises is expected
+console.log = () => {};
+
+function decodeStream(chunk) {
+  const decoded = [];
+  let rx = Buffer.alloc(0);
+  let base = null;
+
+  for (let pos = 0; pos < stream.length; pos += chunk) {
+    rx = Buffer.concat([rx, stream.subarray(pos, pos + chunk)]);
+    for (;;) {
+      const { frame, rest } = nextSnapshotFrame(rx);
+      rx = rest;
+      if (!frame) break;
+
+      if (frame.flags & SNAPSHOT_FLAG_HISTORY) {
+        const h = decodeHistory(frame);
+        decoded.push({ history: { id: h.id, tier: h.tier, now_ms: h.now_ms,
+                                  samples: h.samples.map(s => [s.ts_s, s.mA, s.mV]) } });
+        continue;
+      }
+
+      const snapshot = decodeSnapshotDevices(frame, base);
+      base = snapshot.base;
+      decoded.push({ seq: frame.seq,
+                     devices: snapshot.devices && snapshot.devices.map(d => [d.id, d.flags, d.mA, d.mV, d.age_ms]) });
+    }
+  }
+
+  assert.strictEqual(rx.length, 0, `chunk ${chunk}: ${rx.length} bytes left over`);
+  return decoded;
+}
+
+for (const chunk of [stream.length, 1, 7, 64]) {
+  assert.deepStrictEqual(decodeStream(chunk), vectors.frames, `chunk ${chunk}`);
+}
+
+process.stdout.write(`OK ${vectors.frames.length} frames, ${stream.length} bytes\n`);
@@ -10,6 +10,10 @@
 #include <driver/uart.h>
 #include <vector>
 #include "ap_webpages.h"
+#include "rs485_frame.h"
+#include "snapshot_frame.h"
+#include "spsc_ring.h"
+#include "espnow_discovery.h"
 
 #define DEVICE_TYPE_MASTER
 // #define DEVICE_TYPE_SLAVE
@@ -25,8 +29,22 @@
 #error message("Only WIRELESS or WIRED can be selected")
 #endif
 
+/* Opt in: the wired master also joins WiFi and serves snapshots, history and commands over TCP */
+// #define CONFIG_WIRED_TCP_BRIDGE               1
+
+#if defined(CONFIG_WIRED_TCP_BRIDGE) && ! defined(CONFIG_WIRED)
+#error message("The TCP bridge is for the WIRED master")
+#endif
+
+/* The master keeps a device table for the TCP host, always when wireless, on the wired product only with the bridge */
+#if defined(DEVICE_TYPE_MASTER) && ((CONFIG_WIRELESS == 1) || (CONFIG_WIRED_TCP_BRIDGE == 1))
+#define CONFIG_DEVICE_TABLE                   1
+#endif
+
 #define CONFIG_MASTER_DEVICE_ID               0x01
 
+#define CONFIG_RS485_BAUDRATE                 115200
+
 #define CONFIG_BUILTIN_LED_PIN                8
 #define CONFIG_ESPNOW_DEFAULT_CHANNEL         1
 
@@ -51,14 +69,125 @@ typedef enum {
 
 typedef uint8_t                           DeviceId_t;
 
+/* Status bits reported with a device's readings, same layout as the snapshot packed flags */
+#define DEVICE_ALARM_SMOKE                    0x01
+#define DEVICE_ALARM_FIRE                     0x02
+#define DEVICE_ALARM_VALID                    0x04    //Reporter has smoke/fire inputs
+#define DEVICE_CHARGE_VALID                   0x08    //Reporter classifies its charge state
+#define DEVICE_CHARGE_SHIFT                   4       //ChargeState_e in bits 5..4
+#define DEVICE_CHARGE_MASK                    0x30
+
+/* Numbered like the server's SENSOR_STATUS_* so older code reads the first three the same */
+typedef enum {
+  CHARGE_STATE_NOT_CHARGING = (0),
+  CHARGE_STATE_CHARGING,
+  CHARGE_STATE_FULL,
+  CHARGE_STATE_TAPERING,
+} ChargeState_e;
+
+#define ESPNOW_MSG_VERSION                    1
+
+/* First byte of every binary ESP-NOW message, never printable so it can't be confused with "DISCOVER" */
+typedef enum {
+  ESPNOW_MSG_TELEMETRY = (0x01),
+} EspNowMsgType_e;
+
+typedef struct {
+  uint8_t type;         //ESPNOW_MSG_TELEMETRY
+  uint8_t version;      //ESPNOW_MSG_VERSION
+  DeviceId_t id;
+  uint8_t alarms;       //DEVICE_ALARM_*
+  int32_t mA;           //SNAPSHOT_mA_SCALE units, little endian
+  uint16_t mV;
+} __attribute__((packed)) EspNowTelemetry_st;
+
+typedef enum {
+  HISTORY_TIER_RAW = (0),
+  HISTORY_TIER_1MIN,
+  HISTORY_TIER_15MIN,
+  HISTORY_TIER_MAX
+} HistoryTier_e;
+
+typedef struct {
+  uint32_t ts_s;        //Seconds since boot
+  int16_t mA;
+  uint16_t mV;
+} HistorySample_st;
+
+/* Debounced smoke/fire inputs, a change stays pending until the host acknowledges its seq */
+typedef struct {
+  uint8_t alarms;       //DEVICE_ALARM_SMOKE/FIRE, current level
+  uint8_t latched;      //Bits raised since the last acknowledged change, keeps short pulses visible
+  uint8_t seq;          //Bumped on every change
+  uint8_t acked;        //Last seq the host acknowledged
+  uint32_t ts_ms;       //millis() of the edge behind the last change
+} SensorAlarmEvent_st;
+
+/* Node register map, 16 bit registers read and written over RS485 in ranges */
+typedef enum {
+  SENSOR_REG_FULL_mA = (0),
+  SENSOR_REG_NOTCHARGED_mA,
+  SENSOR_REG_SAMPLE_HZ,
+  SENSOR_REG_REPORT_PERIOD_MS,
+  SENSOR_REG_FILTER_SHIFT,      //EMA alpha = 1 / 2^n, 0 turns the filter off
+  SENSOR_REG_REPORT_MODE,       //SENSOR_REPORT_*
+  SENSOR_REG_CALIBRATION,       //INA219 calibration register, 4096 is nominal for the R100 shunt
+  SENSOR_REG_MAX
+} SensorReg_e;
+
+typedef enum {
+  SENSOR_REG_OK = (0),
+  SENSOR_REG_ERR_ADDRESS,
+  SENSOR_REG_ERR_VALUE,
+} SensorRegStatus_e;
+
+#define SENSOR_REPORT_ON_ALARM                0x01    //Report as soon as smoke/fire changes
+#define SENSOR_REPORT_ON_CHARGE               0x02    //Report as soon as the charge state changes
+
+/* Every sensor register, kept in NVS as one blob so a write costs a single commit */
+typedef struct {
+  uint16_t full_mA;
+  uint16_t notcharged_mA;
+  uint16_t sample_hz;
+  uint16_t report_period_ms;
+  uint8_t filter_shift;
+  uint8_t report_mode;
+  uint16_t calibration;
+} SensorTuning_st;
+
+/* INA219 readings over one publish window */
 typedef struct {
-  uint8_t cmd;
-  uint8_t *data;
-  uint16_t len;
-} QueueMsg_st;
+  float mean_mA;
+  float min_mA;
+  float max_mA;
+  float mean_V;
+  float mean_mW;
+  uint32_t i2c_us_mean;   //Register reads of one sample
+  uint32_t i2c_us_max;
+  uint16_t samples;
+  uint16_t not_ready;     //Polls that found no new conversion
+  uint16_t torn;          //Samples dropped, a conversion kept landing in the middle of the reads
+  uint16_t overflows;     //Samples kept but clipped, the INA219 flagged current or power out of range
+  uint16_t errors;        //I2C failures only
+} SensorWindow_st;
+
+typedef struct {
+  uint32_t rx_frames;
+  uint32_t bad_len;
+  uint32_t bad_crc;
+  uint32_t bad_etx;
+  uint32_t timeout;
+  uint32_t line_err;
+  uint32_t baud_fallback;
+  uint32_t collisions;
+  uint32_t turnaround_us;
+  uint32_t turnaround_max_us;
+} UartStats_st;
 
 void UART_Init();
 bool UART_SendBytes(uint8_t *data, uint16_t data_len);
+void UART_GetStats(UartStats_st *stats);
+void UART_UpdateSensorReply(float mA, float V, bool smoke, bool fire, ChargeState_e charge, uint8_t confidence);
 
 void WIFI_Init();
 void WIFI_AP_ServerLoop();
@@ -70,7 +199,8 @@ bool WIRELESS_Broadcast(String msg);
 bool WIRELESS_IsDiscovered();
 void WIRELESS_ChannelDiscoverLoop(byte channel_start = CONFIG_ESPNOW_DEFAULT_CHANNEL);
 
-void TCP_Send(uint8_t *data, size_t len);
+#define TCP_CLIENT_ALL                        (-1)
+void TCP_Send(uint8_t *data, size_t len, int8_t client = TCP_CLIENT_ALL);
 
 /* Sensor */
 void SENSOR_Setup();
@@ -79,17 +209,35 @@ float SENSOR_GetVoltage(void);
 float SENSOR_GetCurrent_mA(void);
 bool SENSOR_SMOKE_Detected();
 bool SENSOR_FIRE_Detected();
+void SENSOR_GetWindow(SensorWindow_st *window);
+void SENSOR_GetAlarmEvent(SensorAlarmEvent_st *event);
+ChargeState_e SENSOR_GetChargeState(uint8_t *confidence);
+SensorRegStatus_e SENSOR_ReadRegs(uint8_t start, uint8_t count, uint16_t *values);
+SensorRegStatus_e SENSOR_WriteRegs(uint8_t start, uint8_t count, const uint16_t *values);
+void SENSOR_SaveRegs();
+void SENSOR_AckAlarm(uint8_t seq);
 
 /* LED */
 void LED_Init();
 void LED_SendCmd(LedCtrlCmd_e cmd);
 
 void DEVICES_Init();
-void DEVICES_UpdateInfo(DeviceId_t id, float mA, float V);
+void DEVICES_UpdateInfo(DeviceId_t id, float mA, float V, uint8_t alarms = 0);
+void DEVICES_RequestKeyframe();
 void DEVICES_UpdateInfo(const uint8_t *data, int len);
 
+void HISTORY_Init();
+void HISTORY_Append(DeviceId_t id, float mA, float V, uint32_t ts_ms);
+size_t HISTORY_Query(DeviceId_t id, HistoryTier_e tier, uint32_t from_s, uint32_t to_s, HistorySample_st *out, size_t max);
+bool HISTORY_SendRange(DeviceId_t id, HistoryTier_e tier, uint32_t from_s, uint32_t to_s, int8_t client);
+
+void DB_Init();
 int DB_GetDeviceId(int default_value = 2);
 void DB_GetWifiCredentials(String &ssid, String &password);
 void DB_SetWifiCredentials(String &ssid, String &password);
 uint8_t DB_GetEspNowChannel();
 void DB_SetEspNowChannel(uint8_t new_channel);
+uint32_t DB_GetUartBaudrate(uint32_t default_value);
+void DB_SetUartBaudrate(uint32_t new_baudrate);
+bool DB_GetSensorTuning(SensorTuning_st *tuning);
+void DB_SetSensorTuning(const SensorTuning_st *tuning);
@@ -5,65 +5,203 @@
 #define PREF_KEY_WIFI_SSID                          "wifi-ssid"
 #define PREF_KEY_WIFI_PASSWORD                      "wifi-password"
 #define PREF_KEY_ESPNOW_CHANNEL                     "espnow-channel"
+#define PREF_KEY_UART_BAUDRATE                      "uart-baudrate"
+#define PREF_KEY_SENSOR_TUNING                      "sensor-tuning"
+#define PREF_KEY_JOURNAL                            "journal"
 
 #define PREF_READONLY                               true
 #define PREF_READWRITE                              false
 
+#define DB_ESPNOW_CHANNEL_DEFAULT                   1
+
+/* Settings that span several keys are written under a journal entry */
+typedef enum {
+  DB_JOURNAL_NONE = (0),
+  DB_JOURNAL_WIFI_CREDENTIALS,
+} DbJournal_e;
+
+/* RAM copy of the settings namespace, loaded once and kept in sync on every write */
+typedef struct {
+  bool has_device_id;
+  int device_id;
+  bool has_uart_baudrate;
+  uint32_t uart_baudrate;
+  uint8_t espnow_channel;
+  bool has_sensor_tuning;
+  SensorTuning_st sensor_tuning;
+  String wifi_ssid;
+  String wifi_password;
+} DbSettings_st;
+
 static Preferences _pref;
+static DbSettings_st _settings;
+static bool _settingsLoaded = false;
+static SemaphoreHandle_t _dbMutex = NULL;
 
-int DB_GetDeviceId(int default_value)
+static void LocalLoadSettings()
 {
-  int dev_id = 0;
-  _pref.begin(PREF_NAME_SETTINGS, false);
-  dev_id = _pref.getInt(PREF_KEY_DEVICE_ID, default_value);
+  _pref.begin(PREF_NAME_SETTINGS, PREF_READWRITE);
+
+  uint8_t journal = _pref.getUChar(PREF_KEY_JOURNAL, DB_JOURNAL_NONE);
+  if (journal == DB_JOURNAL_WIFI_CREDENTIALS) {
+    /* Power was lost half way through saving the pair, don't trust either */
+    log_e("Incomplete WiFi credentials write, discarding");
+    _pref.remove(PREF_KEY_WIFI_SSID);
+    _pref.remove(PREF_KEY_WIFI_PASSWORD);
+    _pref.putUChar(PREF_KEY_JOURNAL, DB_JOURNAL_NONE);
+  }
+
+  _settings.has_device_id = _pref.isKey(PREF_KEY_DEVICE_ID);
+  _settings.device_id = _pref.getInt(PREF_KEY_DEVICE_ID, 0);
+  _settings.has_uart_baudrate = _pref.isKey(PREF_KEY_UART_BAUDRATE);
+  _settings.uart_baudrate = _pref.getUInt(PREF_KEY_UART_BAUDRATE, 0);
+  _settings.espnow_channel = _pref.getUChar(PREF_KEY_ESPNOW_CHANNEL, DB_ESPNOW_CHANNEL_DEFAULT);
+  /* A blob from a firmware with a different layout is ignored */
+  _settings.has_sensor_tuning = (_pref.getBytesLength(PREF_KEY_SENSOR_TUNING) == sizeof(SensorTuning_st)) &&
+                                (_pref.getBytes(PREF_KEY_SENSOR_TUNING, &_settings.sensor_tuning, sizeof(SensorTuning_st)) == sizeof(SensorTuning_st));
+  _settings.wifi_ssid = _pref.getString(PREF_KEY_WIFI_SSID);
+  _settings.wifi_password = _pref.getString(PREF_KEY_WIFI_PASSWORD);
   _pref.end();
-  return dev_id;
+
+  _settingsLoaded = true;
 }
 
-uint8_t DB_GetEspNowChannel()
+static inline void LocalEnsureLoaded()
 {
-  uint8_t channel;
-  _pref.begin(PREF_NAME_SETTINGS, PREF_READONLY);
-  channel = _pref.getUChar(PREF_KEY_ESPNOW_CHANNEL, 1);
-  _pref.end();
-  log_i("%d", channel);
+  if ( ! _settingsLoaded) {
+    LocalLoadSettings();
+  }
+}
 
-  return channel;
+/* Preferences is not reentrant and the uart, tcp and espnow tasks all write through the RAM copy */
+static void LocalLock()
+{
+  if (_dbMutex) {
+    xSemaphoreTake(_dbMutex, portMAX_DELAY);
+  }
+  LocalEnsureLoaded();
+}
+
+static void LocalUnlock()
+{
+  if (_dbMutex) {
+    xSemaphoreGive(_dbMutex);
+  }
+}
+
+void DB_Init()
+{
+  if (_dbMutex == NULL) {
+    _dbMutex = xSemaphoreCreateMutex();
+  }
+
+  LocalLock();
+  LocalUnlock();
+}
+
+int DB_GetDeviceId(int default_value)
+{
+  LocalEnsureLoaded();
+  return _settings.has_device_id? _settings.device_id : default_value;
+}
+
+uint8_t DB_GetEspNowChannel()
+{
+  LocalEnsureLoaded();
+  return _settings.espnow_channel;
 }
 
 void DB_SetEspNowChannel(uint8_t new_channel)
 {
-  uint8_t db_channel = DB_GetEspNowChannel();
-  if (db_channel != new_channel) {
+  LocalLock();
+  if (_settings.espnow_channel != new_channel) {
+    _settings.espnow_channel = new_channel;
+
     _pref.begin(PREF_NAME_SETTINGS, PREF_READWRITE);
     _pref.putUChar(PREF_KEY_ESPNOW_CHANNEL, new_channel);
     _pref.end();
 
     log_i("DB Set channel: %d", new_channel);
   }
+  LocalUnlock();
+}
+
+uint32_t DB_GetUartBaudrate(uint32_t default_value)
+{
+  LocalEnsureLoaded();
+  return _settings.has_uart_baudrate? _settings.uart_baudrate : default_value;
+}
+
+void DB_SetUartBaudrate(uint32_t new_baudrate)
+{
+  LocalLock();
+  if ( ! _settings.has_uart_baudrate || _settings.uart_baudrate != new_baudrate) {
+    _settings.has_uart_baudrate = true;
+    _settings.uart_baudrate = new_baudrate;
+
+    _pref.begin(PREF_NAME_SETTINGS, PREF_READWRITE);
+    _pref.putUInt(PREF_KEY_UART_BAUDRATE, new_baudrate);
+    _pref.end();
+
+    log_i("DB Set baudrate: %u", new_baudrate);
+  }
+  LocalUnlock();
+}
+
+bool DB_GetSensorTuning(SensorTuning_st *tuning)
+{
+  LocalLock();
+  bool found = _settings.has_sensor_tuning;
+  if (found) {
+    memcpy(tuning, &_settings.sensor_tuning, sizeof(SensorTuning_st));
+  }
+  LocalUnlock();
+  return found;
+}
+
+void DB_SetSensorTuning(const SensorTuning_st *tuning)
+{
+  LocalLock();
+  if ( ! _settings.has_sensor_tuning || memcmp(&_settings.sensor_tuning, tuning, sizeof(SensorTuning_st)) != 0) {
+    _settings.has_sensor_tuning = true;
+    memcpy(&_settings.sensor_tuning, tuning, sizeof(SensorTuning_st));
+
+    _pref.begin(PREF_NAME_SETTINGS, PREF_READWRITE);
+    _pref.putBytes(PREF_KEY_SENSOR_TUNING, tuning, sizeof(SensorTuning_st));
+    _pref.end();
+
+    log_i("DB Set sensor tuning: full %u mA, not charged %u mA, %u Hz, %u ms, filter %u, mode 0x%02X, calibration %u",
+          tuning->full_mA, tuning->notcharged_mA, tuning->sample_hz, tuning->report_period_ms,
+          tuning->filter_shift, tuning->report_mode, tuning->calibration);
+  }
+  LocalUnlock();
 }
 
 void DB_GetWifiCredentials(String &ssid, String &password)
 {
-  _pref.begin(PREF_NAME_SETTINGS, PREF_READONLY);
-  ssid = _pref.getString(PREF_KEY_WIFI_SSID);
-  password = _pref.getString(PREF_KEY_WIFI_PASSWORD);
-  _pref.end();
+  LocalLock();
+  ssid = _settings.wifi_ssid;
+  password = _settings.wifi_password;
+  LocalUnlock();
 
   log_i("WiFi Credentials: %s - %s", ssid.c_str(), password.c_str());
 }
 
 void DB_SetWifiCredentials(String &ssid, String &password)
 {
-  String db_ssid, db_password;
-  DB_GetWifiCredentials(db_ssid, db_password);
-  
-  if (db_ssid != ssid || db_password != password)
+  LocalLock();
+  if (_settings.wifi_ssid != ssid || _settings.wifi_password != password)
   {
+    _settings.wifi_ssid = ssid;
+    _settings.wifi_password = password;
+
     _pref.begin(PREF_NAME_SETTINGS, PREF_READWRITE);
+    _pref.putUChar(PREF_KEY_JOURNAL, DB_JOURNAL_WIFI_CREDENTIALS);
     _pref.putString(PREF_KEY_WIFI_SSID, ssid);
     _pref.putString(PREF_KEY_WIFI_PASSWORD, password);
+    _pref.putUChar(PREF_KEY_JOURNAL, DB_JOURNAL_NONE);
     _pref.end();
     log_i("WiFi Credentials Saved: %s - %s", ssid.c_str(), password.c_str());
   }
+  LocalUnlock();
 }
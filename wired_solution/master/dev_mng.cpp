@@ -1,88 +1,335 @@
 #include "common.h"
 
-#define DEVICE_NUM_BUFFER                   10
+#define DEVICE_ID_MAX                       0xFF    //ID 0 is the RS485 broadcast address, never a device
+#define DEVICE_TABLE_SIZE                   (DEVICE_ID_MAX + 1)
+#define DEVICE_BITMAP_WORDS                 (DEVICE_TABLE_SIZE / 32)
 
+#define DEVICE_PUBLISH_WINDOW               100     //ms, updates arriving within the window go out together
+#define DEVICE_KEYFRAME_INTERVAL            10000   //ms, full snapshot so the server can resync
+#define DEVICE_DEADBAND_mA                  5.0f
+#define DEVICE_DEADBAND_V                   0.05f
+
+#define DEVICE_SENSOR_RING_SIZE             4       //Local INA219, one report every 2 s
+#define DEVICE_RADIO_RING_SIZE              32      //ESP-NOW reports, slaves tend to report in bursts
+
+/* Snapshot TIMESTAMP and BASE_SEQ, then worst case one DEVICES_PACKED record per device */
+#define DEVICE_PACKED_RECORD_MAX            0xFF
+#define DEVICE_SNAPSHOT_SIZE_MAX            (SNAPSHOT_OVERHEAD + SNAPSHOT_RECORD_OVERHEAD * 2 + sizeof(uint32_t) + sizeof(uint16_t) + \
+                                             DEVICE_ID_MAX * (SNAPSHOT_RECORD_OVERHEAD + SNAPSHOT_PACKED_DEVICE_MAX))
+
+typedef struct {
+  DeviceId_t id;
+  uint8_t alarms;
+  float mA;
+  float V;
+  uint32_t updated_ms;
+} DeviceInfo_st;
+
+/* One report on its way from a producer to dev_mng_task */
 typedef struct {
   DeviceId_t id;
+  uint8_t alarms;
+  float mA;
+  float V;
+  uint32_t ts_ms;
+} DeviceUpdate_st;
+
+typedef struct {
+  uint8_t alarms;
   float mA;
   float V;
-} __attribute__((packed)) DeviceInfo_st;
+  uint32_t updated_ms;
+} DeviceEntry_st;
 
-std::vector<DeviceInfo_st> devices_;
+static_assert(DEVICE_ALARM_SMOKE == SNAPSHOT_PACKED_SMOKE && DEVICE_ALARM_FIRE == SNAPSHOT_PACKED_FIRE &&
+              DEVICE_ALARM_VALID == SNAPSHOT_PACKED_ALARM_VALID && DEVICE_CHARGE_VALID == SNAPSHOT_PACKED_CHARGE_VALID &&
+              DEVICE_CHARGE_SHIFT == SNAPSHOT_PACKED_CHARGE_SHIFT, "Status bits are copied into the snapshot as is");
+
+/* Owned by dev_mng_task: producers only reach the table through the rings, so it needs no locking */
+static DeviceEntry_st _devices[DEVICE_TABLE_SIZE];
+static uint32_t _devicePresent[DEVICE_BITMAP_WORDS] = { 0 };
+static uint32_t _deviceDirty[DEVICE_BITMAP_WORDS] = { 0 };
+
+static SpscRing<DeviceUpdate_st, DEVICE_SENSOR_RING_SIZE> _sensorRing;    //sensor_task -> dev_mng_task
+static SpscRing<DeviceUpdate_st, DEVICE_RADIO_RING_SIZE> _radioRing;      //espnow_rx_task -> dev_mng_task
+static TaskHandle_t _devMngTask = NULL;
+static uint16_t _snapshotSeq = 0;
+static bool _keyframeRequested = false;
+
+/* Owned by dev_mng_task: what the server was last told about each device */
+static float _publishedmA[DEVICE_TABLE_SIZE];
+static float _publishedV[DEVICE_TABLE_SIZE];
+static uint8_t _publishedAlarms[DEVICE_TABLE_SIZE];
+static uint32_t _devicePublished[DEVICE_BITMAP_WORDS] = { 0 };
+
+/* Owned by dev_mng_task: fixed point values sent in the last keyframe, deltas are against these */
+static uint16_t _keyframeSeq = 0;
+static int32_t _keyframemA[DEVICE_TABLE_SIZE];
+static int32_t _keyframemV[DEVICE_TABLE_SIZE];
+static uint32_t _deviceInKeyframe[DEVICE_BITMAP_WORDS] = { 0 };
 
 static void dev_mng_task(void *param);
 
-int8_t LocalDeviceExist(DeviceId_t id)
+static void LocalDeviceWrite(const DeviceUpdate_st *update)
 {
-  int8_t index = -1;
-  for (size_t i = 0; i < devices_.size(); i++) {
-    if (devices_[i].id == id) {
-      index = i;
-      break;
-    }
-  }
+  DeviceEntry_st *entry = &_devices[update->id];
 
-  return index;
+  entry->alarms = update->alarms;
+  entry->mA = update->mA;
+  entry->V = update->V;
+  entry->updated_ms = update->ts_ms;
+}
+
+static void LocalDeviceRead(DeviceId_t id, DeviceInfo_st *info)
+{
+  const DeviceEntry_st *entry = &_devices[id];
+
+  info->id = id;
+  info->alarms = entry->alarms;
+  info->mA = entry->mA;
+  info->V = entry->V;
+  info->updated_ms = entry->updated_ms;
 }
 
 void DEVICES_Init()
 {
-  xTaskCreate(dev_mng_task, "dev_mng_task", 4096, NULL, 2, NULL);
+  HISTORY_Init();
+  xTaskCreate(dev_mng_task, "dev_mng_task", 4096, NULL, 2, &_devMngTask);
 }
 
-void DEVICES_UpdateInfo(DeviceId_t id, float mA, float V)
+void DEVICES_RequestKeyframe()
 {
-  int8_t dev_index = LocalDeviceExist(id);
-  if (dev_index >= 0) {
-    devices_[dev_index].id = id;
-    devices_[dev_index].mA = mA;
-    devices_[dev_index].V = V;
-  } else {
-    DeviceInfo_st new_dev = { id, mA, V };
-    devices_.push_back(new_dev);
-    log_i("New device (%d)", id);
+  __atomic_store_n(&_keyframeRequested, true, __ATOMIC_RELEASE);
+  if (_devMngTask) {
+    xTaskNotifyGive(_devMngTask);
+  }
+}
+
+template <class RING>
+static void LocalQueueUpdate(RING &ring, DeviceId_t id, float mA, float V, uint8_t alarms)
+{
+  if (id == 0) {
+    log_e("Invalid device id: %d", id);
+    return;
+  }
+
+  DeviceUpdate_st *update = ring.PushBegin();
+  if (update == NULL) {
+    return;
+  }
+
+  update->id = id;
+  update->alarms = alarms;
+  update->mA = mA;
+  update->V = V;
+  update->ts_ms = millis();
+  ring.PushCommit();
+
+  if (_devMngTask) {
+    xTaskNotifyGive(_devMngTask);
+  }
+}
+
+/* Returns true when the update changes the device's alarm bits */
+static bool LocalApplyUpdate(const DeviceUpdate_st *update)
+{
+  bool alarmChanged = (_devices[update->id].alarms ^ update->alarms) & (DEVICE_ALARM_SMOKE | DEVICE_ALARM_FIRE);
+  LocalDeviceWrite(update);
+  /* Every report, not only the last one before a publish */
+  HISTORY_Append(update->id, update->mA, update->V, update->ts_ms);
+
+  uint32_t mask = 1UL << (update->id & 31);
+  if ((_devicePresent[update->id >> 5] & mask) == 0) {
+    _devicePresent[update->id >> 5] |= mask;
+    log_i("New device (%d)", update->id);
+  }
+
+  _deviceDirty[update->id >> 5] |= mask;
+  log_i("(%d) %.2f (mA), %.2f (V)", update->id, update->mA, update->V);
+  return alarmChanged;
+}
+
+template <class RING>
+static bool LocalDrainRing(RING &ring)
+{
+  bool alarmChanged = false;
+  DeviceUpdate_st *update;
+  while ((update = ring.PopBegin()) != NULL) {
+    alarmChanged |= LocalApplyUpdate(update);
+    ring.PopCommit();
+  }
+  return alarmChanged;
+}
+
+template <class RING>
+static void LocalLogRingStats(const char *name, RING &ring, uint32_t &lastDropped)
+{
+  uint32_t dropped = ring.Dropped();
+  if (dropped != lastDropped) {
+    log_e("%s ring dropped %u (high water %u/%u)", name, dropped - lastDropped, ring.HighWater(), ring.Capacity());
+    lastDropped = dropped;
   }
+}
 
-  log_i("(%d) %.2f (mA), %.2f (V)", id, mA, V);
+/* Called from sensor_task */
+void DEVICES_UpdateInfo(DeviceId_t id, float mA, float V, uint8_t alarms)
+{
+  LocalQueueUpdate(_sensorRing, id, mA, V, alarms);
 }
 
+/* Called from espnow_rx_task */
 void DEVICES_UpdateInfo(const uint8_t *data, int len)
 {
-  JsonDocument doc;
-  DeserializationError error = deserializeJson(doc, data, len);
-  if (DeserializationError::Ok == error)
-  {
-    DEVICES_UpdateInfo(doc["id"].as<int>(), doc["mA"].as<float>(), doc["V"].as<float>());
+  EspNowTelemetry_st msg;
+  if (len < (int)sizeof(msg)) {
+    return;
   }
+
+  /* Copy out first, the radio buffer has no alignment guarantee */
+  memcpy(&msg, data, sizeof(msg));
+  if (msg.type != ESPNOW_MSG_TELEMETRY || msg.version != ESPNOW_MSG_VERSION) {
+    return;
+  }
+
+  LocalQueueUpdate(_radioRing, msg.id, (float)msg.mA / SNAPSHOT_mA_SCALE, (float)msg.mV / SNAPSHOT_mV_SCALE, msg.alarms);
 }
 
-void dev_mng_task(void *param)
+static bool LocalOutsideDeadband(DeviceId_t id, const DeviceInfo_st *info)
 {
-  while (1)
-  {
-    delay(2000);
+  if ((_devicePublished[id >> 5] & (1UL << (id & 31))) == 0) {
+    return true;
+  }
+
+  return info->alarms != _publishedAlarms[id] ||
+         fabsf(info->mA - _publishedmA[id]) >= DEVICE_DEADBAND_mA ||
+         fabsf(info->V - _publishedV[id]) >= DEVICE_DEADBAND_V;
+}
+
+/* Sends every known device on a keyframe, otherwise only the ones that moved past the deadband */
+static void LocalPublish(bool keyframe)
+{
+  static uint8_t packet[DEVICE_SNAPSHOT_SIZE_MAX];
+  SnapshotWriter writer(packet, sizeof(packet));
+  uint8_t record[DEVICE_PACKED_RECORD_MAX];
+  size_t recordLen = 0;
+  uint32_t now = millis();
+
+  writer.Begin(_snapshotSeq, keyframe? SNAPSHOT_FLAG_KEYFRAME : 0);
+  writer.AddU32(SNAPSHOT_REC_TIMESTAMP, now);
+  if (keyframe) {
+    memset(_deviceInKeyframe, 0, sizeof(_deviceInKeyframe));
+  } else {
+    writer.AddU16(SNAPSHOT_REC_BASE_SEQ, _keyframeSeq);
+  }
+
+  uint8_t count = 0;
+  for (uint8_t w = 0; w < DEVICE_BITMAP_WORDS; w++) {
+    uint32_t present = _devicePresent[w];
+    uint32_t dirty = _deviceDirty[w];
+    _deviceDirty[w] = 0;
+    uint32_t pending = keyframe? present : (present & dirty);
+
+    while (pending) {
+      uint8_t bit = __builtin_ctz(pending);
+      pending &= pending - 1;
+
+      DeviceId_t id = (w << 5) | bit;
+      if (id == 0) {
+        continue;
+      }
+
+      DeviceInfo_st info;
+      LocalDeviceRead(id, &info);
+
+      if ( ! keyframe && ! LocalOutsideDeadband(id, &info)) {
+        /* Keep comparing against the last published value so slow drift still gets out */
+        continue;
+      }
+
+      _publishedmA[id] = info.mA;
+      _publishedV[id] = info.V;
+      _publishedAlarms[id] = info.alarms;
+      _devicePublished[w] |= (1UL << bit);
+
+      SnapshotPackedDevice_st dev;
+      dev.id = info.id;
+      dev.flags = info.alarms;
+      dev.mA = lroundf(info.mA * SNAPSHOT_mA_SCALE);
+      dev.mV = lroundf(info.V * SNAPSHOT_mV_SCALE);
+      dev.age_ms = now - info.updated_ms;
 
-    if (devices_.size() == 0) {
-      continue;
+      if (keyframe) {
+        _keyframemA[id] = dev.mA;
+        _keyframemV[id] = dev.mV;
+        _deviceInKeyframe[w] |= (1UL << bit);
+      } else if (_deviceInKeyframe[w] & (1UL << bit)) {
+        dev.mA -= _keyframemA[id];
+        dev.mV -= _keyframemV[id];
+      } else {
+        dev.flags |= SNAPSHOT_PACKED_ABSOLUTE;
+      }
+
+      if (recordLen + SNAPSHOT_PACKED_DEVICE_MAX > sizeof(record)) {
+        writer.Add(SNAPSHOT_REC_DEVICES_PACKED, record, recordLen);
+        recordLen = 0;
+      }
+      recordLen += SNAPSHOT_PackDevice(&record[recordLen], &dev);
+      count++;
     }
+  }
+
+  if (recordLen) {
+    writer.Add(SNAPSHOT_REC_DEVICES_PACKED, record, recordLen);
+  }
 
-    size_t packet_len = devices_.size() * sizeof(DeviceInfo_st) + 1 /* Number of device */;
+  if (count == 0 && ! keyframe) {
+    return;
+  }
+
+  size_t len = writer.Finish();
+  if (len == 0) {
+    log_e("Snapshot does not fit, %d devices", count);
+    return;
+  }
 
-    uint8_t *packet = (uint8_t *)malloc(packet_len);
-    if (packet) {
-      packet[0] = (uint8_t)devices_.size();
-      uint8_t *ptr = &packet[1];
-      for (size_t i = 0; i < packet[0]; i++) {
-        *ptr = devices_[i].id; ptr++;
-        memcpy(ptr, &devices_[i].mA, sizeof(float)); ptr += sizeof(float);
-        memcpy(ptr, &devices_[i].V, sizeof(float)); ptr += sizeof(float);
+  if (keyframe) {
+    _keyframeSeq = _snapshotSeq;
+  }
+  _snapshotSeq++;
+  TCP_Send(packet, len);
+}
+
+void dev_mng_task(void *param)
+{
+  const TickType_t keyframeTicks = pdMS_TO_TICKS(DEVICE_KEYFRAME_INTERVAL);
+  TickType_t lastKeyframe = xTaskGetTickCount();
+  uint32_t sensorDropped = 0, radioDropped = 0;
+
+  while (1)
+  {
+    TickType_t elapsed = xTaskGetTickCount() - lastKeyframe;
+    TickType_t wait = (elapsed >= keyframeTicks)? 0 : (keyframeTicks - elapsed);
+
+    if (ulTaskNotifyTake(pdTRUE, wait)) {
+      /* Alarms go out right away, anything else lets updates from other devices in the same burst join this publish */
+      bool alarmChanged = LocalDrainRing(_sensorRing);
+      alarmChanged |= LocalDrainRing(_radioRing);
+      if ( ! alarmChanged) {
+        vTaskDelay(pdMS_TO_TICKS(DEVICE_PUBLISH_WINDOW));
       }
+      ulTaskNotifyTake(pdTRUE, 0);
+    }
 
-      // UART_SendBytes(packet, packet_len);
-      TCP_Send(packet, packet_len);
-      free(packet);
-    } else {
-      //
+    bool keyframe = __atomic_exchange_n(&_keyframeRequested, false, __ATOMIC_ACQUIRE) ||
+                    (xTaskGetTickCount() - lastKeyframe) >= keyframeTicks;
+    if (keyframe) {
+      lastKeyframe = xTaskGetTickCount();
+      LocalLogRingStats("Sensor", _sensorRing, sensorDropped);
+      LocalLogRingStats("Radio", _radioRing, radioDropped);
     }
+
+    LocalDrainRing(_sensorRing);
+    LocalDrainRing(_radioRing);
+    LocalPublish(keyframe);
   }
 }
@@ -0,0 +1,210 @@
+#include "common.h"
+#include <esp_heap_caps.h>
+
+#define HISTORY_ID_COUNT                    256     //Every DeviceId_t value
+#define HISTORY_DEVICE_MAX                  16      //Devices with history, allocated on first sample
+
+#define HISTORY_RAW_SIZE                    64      //~2 min at the 2 s report rate
+#define HISTORY_1MIN_SIZE                   120     //2 hours
+#define HISTORY_15MIN_SIZE                  96      //24 hours
+#define HISTORY_SAMPLES_PER_DEVICE          (HISTORY_RAW_SIZE + HISTORY_1MIN_SIZE + HISTORY_15MIN_SIZE)
+#define HISTORY_TIER_SIZE_MAX               HISTORY_1MIN_SIZE       //Largest tier, sizes the query buffer and the reply
+
+#define HISTORY_REPLY_RECORD_MAX            0xFF
+#define HISTORY_REPLY_SIZE_MAX              (SNAPSHOT_OVERHEAD + (SNAPSHOT_RECORD_OVERHEAD * 2) + sizeof(uint32_t) + 10 + \
+                                             HISTORY_TIER_SIZE_MAX * (SNAPSHOT_RECORD_OVERHEAD + SNAPSHOT_HISTORY_SAMPLE_MAX))
+
+typedef struct {
+  uint32_t period_s;    //0 keeps every sample
+  uint16_t size;
+} HistoryTierCfg_st;
+
+/* Ring of samples, plus the running sum of the bucket that is not closed yet */
+typedef struct {
+  HistorySample_st *samples;
+  uint16_t head;
+  uint16_t count;
+  uint32_t bucket;
+  int32_t sum_mA;
+  uint32_t sum_mV;
+  uint16_t n;
+} HistoryRing_st;
+
+typedef struct {
+  HistoryRing_st tier[HISTORY_TIER_MAX];
+  HistorySample_st samples[HISTORY_SAMPLES_PER_DEVICE];
+} HistoryDevice_st;
+
+static const HistoryTierCfg_st _tierCfg[HISTORY_TIER_MAX] = {
+  { 0,   HISTORY_RAW_SIZE },
+  { 60,  HISTORY_1MIN_SIZE },
+  { 900, HISTORY_15MIN_SIZE },
+};
+
+static HistoryDevice_st *_history[HISTORY_ID_COUNT] = { NULL };
+static uint8_t _historyDevices = 0;
+static SemaphoreHandle_t _historyMutex = NULL;
+
+static HistoryDevice_st *LocalGetDevice(DeviceId_t id, bool create)
+{
+  if (_history[id] || ! create) {
+    return _history[id];
+  }
+
+  if (_historyDevices >= HISTORY_DEVICE_MAX) {
+    return NULL;
+  }
+
+  /* Prefer PSRAM when the module has it, internal RAM otherwise */
+  HistoryDevice_st *dev = (HistoryDevice_st *)heap_caps_malloc(sizeof(HistoryDevice_st), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (dev == NULL) {
+    dev = (HistoryDevice_st *)malloc(sizeof(HistoryDevice_st));
+  }
+  if (dev == NULL) {
+    log_e("No memory for history of device %d", id);
+    return NULL;
+  }
+
+  memset(dev, 0, sizeof(HistoryDevice_st));
+  HistorySample_st *samples = dev->samples;
+  for (uint8_t t = 0; t < HISTORY_TIER_MAX; t++) {
+    dev->tier[t].samples = samples;
+    samples += _tierCfg[t].size;
+  }
+
+  _history[id] = dev;
+  _historyDevices++;
+  log_i("History for device %d (%d/%d)", id, _historyDevices, HISTORY_DEVICE_MAX);
+  return dev;
+}
+
+static void LocalRingPush(HistoryRing_st *ring, uint16_t size, const HistorySample_st *sample)
+{
+  ring->samples[ring->head] = *sample;
+  ring->head = (ring->head + 1) % size;
+  if (ring->count < size) {
+    ring->count++;
+  }
+}
+
+void HISTORY_Init()
+{
+  if (_historyMutex == NULL) {
+    _historyMutex = xSemaphoreCreateMutex();
+  }
+}
+
+void HISTORY_Append(DeviceId_t id, float mA, float V, uint32_t ts_ms)
+{
+  if (_historyMutex == NULL) {
+    return;
+  }
+
+  HistorySample_st sample;
+  sample.ts_s = ts_ms / 1000;
+  sample.mA = (int16_t)constrain(lroundf(mA), INT16_MIN, INT16_MAX);
+  sample.mV = (uint16_t)constrain(lroundf(V * 1000), 0, UINT16_MAX);
+
+  xSemaphoreTake(_historyMutex, portMAX_DELAY);
+  HistoryDevice_st *dev = LocalGetDevice(id, true);
+  if (dev) {
+    for (uint8_t t = 0; t < HISTORY_TIER_MAX; t++) {
+      HistoryRing_st *ring = &dev->tier[t];
+      uint32_t period = _tierCfg[t].period_s;
+
+      if (period == 0) {
+        LocalRingPush(ring, _tierCfg[t].size, &sample);
+        continue;
+      }
+
+      /* A sample in a new bucket closes the previous one with its mean */
+      uint32_t bucket = sample.ts_s / period;
+      if (ring->n && bucket != ring->bucket) {
+        HistorySample_st mean = { ring->bucket * period, (int16_t)(ring->sum_mA / ring->n), (uint16_t)(ring->sum_mV / ring->n) };
+        LocalRingPush(ring, _tierCfg[t].size, &mean);
+        ring->n = 0;
+        ring->sum_mA = 0;
+        ring->sum_mV = 0;
+      }
+
+      ring->bucket = bucket;
+      ring->sum_mA += sample.mA;
+      ring->sum_mV += sample.mV;
+      ring->n++;
+    }
+  }
+  xSemaphoreGive(_historyMutex);
+}
+
+size_t HISTORY_Query(DeviceId_t id, HistoryTier_e tier, uint32_t from_s, uint32_t to_s, HistorySample_st *out, size_t max)
+{
+  if (_historyMutex == NULL || tier >= HISTORY_TIER_MAX) {
+    return 0;
+  }
+
+  size_t count = 0;
+  xSemaphoreTake(_historyMutex, portMAX_DELAY);
+  HistoryDevice_st *dev = LocalGetDevice(id, false);
+  if (dev) {
+    const HistoryRing_st *ring = &dev->tier[tier];
+    uint16_t size = _tierCfg[tier].size;
+    uint16_t start = (ring->head + size - ring->count) % size;
+
+    for (uint16_t i = 0; i < ring->count && count < max; i++) {
+      const HistorySample_st *sample = &ring->samples[(start + i) % size];
+      if (from_s <= sample->ts_s && sample->ts_s <= to_s) {
+        out[count++] = *sample;
+      }
+    }
+  }
+  xSemaphoreGive(_historyMutex);
+
+  return count;
+}
+
+bool HISTORY_SendRange(DeviceId_t id, HistoryTier_e tier, uint32_t from_s, uint32_t to_s, int8_t client)
+{
+  static HistorySample_st samples[HISTORY_TIER_SIZE_MAX];
+  static uint8_t packet[HISTORY_REPLY_SIZE_MAX];
+  static_assert(HISTORY_RAW_SIZE <= HISTORY_TIER_SIZE_MAX && HISTORY_15MIN_SIZE <= HISTORY_TIER_SIZE_MAX, "Query buffer smaller than a tier");
+
+  if (tier >= HISTORY_TIER_MAX) {
+    return false;
+  }
+
+  size_t count = HISTORY_Query(id, tier, from_s, to_s, samples, sizeof(samples) / sizeof(samples[0]));
+
+  SnapshotWriter writer(packet, sizeof(packet));
+  uint8_t query[10] = { id, (uint8_t)tier,
+                        (uint8_t)from_s, (uint8_t)(from_s >> 8), (uint8_t)(from_s >> 16), (uint8_t)(from_s >> 24),
+                        (uint8_t)to_s, (uint8_t)(to_s >> 8), (uint8_t)(to_s >> 16), (uint8_t)(to_s >> 24) };
+  writer.Begin(0, SNAPSHOT_FLAG_HISTORY);
+  writer.AddU32(SNAPSHOT_REC_TIMESTAMP, millis());
+  writer.Add(SNAPSHOT_REC_HISTORY_QUERY, query, sizeof(query));
+
+  uint8_t record[HISTORY_REPLY_RECORD_MAX];
+  size_t recordLen = 0;
+  uint32_t prevTs = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (recordLen + SNAPSHOT_HISTORY_SAMPLE_MAX > sizeof(record)) {
+      writer.Add(SNAPSHOT_REC_HISTORY_SAMPLES, record, recordLen);
+      recordLen = 0;
+    }
+    recordLen += SNAPSHOT_PutVarint(&record[recordLen], samples[i].ts_s - prevTs);
+    recordLen += SNAPSHOT_PutVarint(&record[recordLen], SNAPSHOT_ZigZag(samples[i].mA));
+    recordLen += SNAPSHOT_PutVarint(&record[recordLen], samples[i].mV);
+    prevTs = samples[i].ts_s;
+  }
+  if (recordLen) {
+    writer.Add(SNAPSHOT_REC_HISTORY_SAMPLES, record, recordLen);
+  }
+
+  size_t len = writer.Finish();
+  if (len == 0) {
+    log_e("History reply does not fit, %d samples", count);
+    return false;
+  }
+
+  TCP_Send(packet, len, client);
+  return true;
+}
@@ -1,60 +1,320 @@
 #include "common.h"
 
-#define SMOKE_PIN                 4
+#define SMOKE_PIN                 1       //Not 4, that is RS485_TX
 #define FIRE_PIN                  5
 #define INA219_SDA_PIN            6
 #define INA219_SCL_PIN            7
 
+#define INA219_REG_CONFIG         0x00
+#define INA219_REG_SHUNT          0x01
+#define INA219_REG_BUS            0x02
+#define INA219_REG_POWER          0x03
+#define INA219_REG_CURRENT        0x04
+#define INA219_REG_CALIBRATION    0x05
+#define INA219_CALIBRATION        4096      //0.1 mA current LSB, 2 mW power LSB with the R100 shunt, trimmed via SENSOR_REG_CALIBRATION
+#define INA219_POWER_mW_LSB       2
+#define INA219_CONFIG_RANGE       0x3800    //32 V bus, 320 mV shunt, as the library's 32V_2A calibration
+#define INA219_CONFIG_CONTINUOUS  0x0007    //Shunt and bus, continuous
+#define INA219_ADC_12BIT          0x3
+#define INA219_ADC_AVG            0x8       //| log2(samples), 2..128
+#define INA219_ADC_AVG_LOG2_MAX   7
+#define INA219_ADC_CONV_US        532       //One 12 bit conversion
+#define INA219_BUS_OVF            0x0001    //Current or power out of range, the sample is clipped
+#define INA219_BUS_CNVR           0x0002    //Set when a conversion completes, cleared by reading power
+#define INA219_I2C_CLOCK          400000    //Fast mode, the chip's high speed mode needs an HS master code
+
+#define SENSOR_SAMPLE_PERIOD_DEFAULT  2000
+#define SENSOR_SAMPLE_PERIOD_MIN      100
+#define SENSOR_SAMPLE_PERIOD_MAX      60000
+#define SENSOR_SAMPLE_HZ_DEFAULT      100
+#define SENSOR_SAMPLE_HZ_MIN          10
+#define SENSOR_SAMPLE_HZ_MAX          200
+#define SENSOR_FILTER_SHIFT_DEFAULT   5       //alpha = 1/32, ~0.3 s at 100 Hz
+#define SENSOR_FILTER_SHIFT_MAX       8
+#define SENSOR_REPORT_MODE_DEFAULT    (SENSOR_REPORT_ON_ALARM | SENSOR_REPORT_ON_CHARGE)
+#define SENSOR_THRESHOLD_mA_MAX       3200    //INA219 full scale with the R100 shunt
+#define SENSOR_EMA_FRAC               8       //Q8 fixed point
+#define SENSOR_SAMPLE_ATTEMPTS        3       //Register reads that straddle a conversion are retried
+#define SENSOR_DEBOUNCE_MS            30      //Inputs must be quiet this long
+#define SENSOR_CHARGE_DWELL_MS        3000    //A new charge state must hold this long on the filtered current
+#define SENSOR_TAPER_PCT              150     //Charging below this share of the full threshold is tapering
+#define SENSOR_FULL_mA_DEFAULT        300     //Same defaults as the server's store
+#define SENSOR_NOTCHARGED_mA_DEFAULT  100
+
+/* Fixed point filter state, currents in SNAPSHOT_mA_SCALE units */
+typedef struct {
+  bool seeded;
+  int32_t mA;           //Q8
+  int32_t mV;           //Q8
+} SensorEma_st;
+
+/* Charge state machine, fed with the filtered current on every sample */
+typedef struct {
+  ChargeState_e state;
+  ChargeState_e candidate;
+  uint32_t candidate_ms;
+  uint16_t agree;       //Raw samples in this window that classify as the reported state
+  uint16_t total;
+} SensorCharge_st;
+
+typedef struct {
+  uint16_t min;
+  uint16_t max;
+} SensorRegRange_st;
+
+typedef struct {
+  int32_t min_mA;
+  int32_t max_mA;
+  int32_t sum_mA;
+  uint32_t sum_mV;
+  uint32_t sum_mW;
+  uint32_t sum_i2c_us;
+  uint32_t max_i2c_us;
+  uint16_t samples;
+  uint16_t not_ready;
+  uint16_t torn;
+  uint16_t overflows;
+  uint16_t errors;
+} SensorAccum_st;
+
 Adafruit_INA219 ina219;
 static bool _deviceFound = false;
 float _shuntvoltage = 0;
 float _busvoltage = 0;
 float _current_mA = 0;
+static volatile uint32_t _samplePeriodMs = SENSOR_SAMPLE_PERIOD_DEFAULT;
+static volatile uint16_t _sampleHz = SENSOR_SAMPLE_HZ_DEFAULT;
+static volatile uint16_t _fullmA = SENSOR_FULL_mA_DEFAULT;
+static volatile uint16_t _notchargedmA = SENSOR_NOTCHARGED_mA_DEFAULT;
+static volatile uint8_t _filterShift = SENSOR_FILTER_SHIFT_DEFAULT;
+static volatile uint8_t _reportMode = SENSOR_REPORT_MODE_DEFAULT;
+static volatile uint16_t _calibration = INA219_CALIBRATION;
+static volatile bool _reconfigure = false;     //Sample rate or calibration changed, sensor_task rewrites the INA219
+static SemaphoreHandle_t _regMutex = NULL;
+
+static const SensorRegRange_st _regRange[SENSOR_REG_MAX] = {
+  { 1,                          SENSOR_THRESHOLD_mA_MAX },    //FULL_mA
+  { 0,                          SENSOR_THRESHOLD_mA_MAX },    //NOTCHARGED_mA
+  { SENSOR_SAMPLE_HZ_MIN,       SENSOR_SAMPLE_HZ_MAX },       //SAMPLE_HZ
+  { SENSOR_SAMPLE_PERIOD_MIN,   SENSOR_SAMPLE_PERIOD_MAX },   //REPORT_PERIOD_MS
+  { 0,                          SENSOR_FILTER_SHIFT_MAX },    //FILTER_SHIFT
+  { 0,                          SENSOR_REPORT_MODE_DEFAULT }, //REPORT_MODE
+  { 1,                          0xFFFE },                     //CALIBRATION, bit 0 is not used by the chip
+};
+static SensorWindow_st _window;
+static portMUX_TYPE _windowMux = portMUX_INITIALIZER_UNLOCKED;
+
+static SensorAlarmEvent_st _alarmEvent = { 0 };
+static portMUX_TYPE _alarmMux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t _alarmTask = NULL;
+static volatile bool _alarmEdge = false;
+static volatile uint32_t _alarmEdgeMs = 0;
+static volatile bool _reportNow = false;       //sensor_task reports without waiting for the window
+static volatile ChargeState_e _chargeState = CHARGE_STATE_NOT_CHARGING;
+static volatile uint8_t _chargeConfidence = 0;
 
 static void sensor_task(void *arg);
+static void alarm_task(void *arg);
+
+static void IRAM_ATTR LocalAlarmIsr()
+{
+  BaseType_t woken = pdFALSE;
+
+  if ( ! _alarmEdge) {
+    _alarmEdgeMs = millis();
+    _alarmEdge = true;
+  }
+  vTaskNotifyGiveFromISR(_alarmTask, &woken);
+  portYIELD_FROM_ISR(woken);
+}
+
+static uint8_t LocalReadAlarmPins()
+{
+  /* MQ-2 Sensor is active LOW */
+  return (digitalRead(SMOKE_PIN) == LOW? DEVICE_ALARM_SMOKE : 0) | (digitalRead(FIRE_PIN) == HIGH? DEVICE_ALARM_FIRE : 0);
+}
+
+static uint8_t LocalReportedAlarms()
+{
+  portENTER_CRITICAL(&_alarmMux);
+  uint8_t alarms = _alarmEvent.alarms | _alarmEvent.latched;
+  portEXIT_CRITICAL(&_alarmMux);
+  return alarms;
+}
 
 void SENSOR_SMOKE_Setup()
 {
   pinMode(SMOKE_PIN, INPUT_PULLDOWN);
+  attachInterrupt(digitalPinToInterrupt(SMOKE_PIN), LocalAlarmIsr, CHANGE);
 }
 
 void SENSOR_FIRE_Setup()
 {
   pinMode(FIRE_PIN, INPUT_PULLDOWN);
+  attachInterrupt(digitalPinToInterrupt(FIRE_PIN), LocalAlarmIsr, CHANGE);
 }
 
+/* Debounced level, or a pulse since the last acknowledged change */
 bool SENSOR_SMOKE_Detected()
 {
-  /* MQ-2 Sensor is active LOW */
-  return digitalRead(SMOKE_PIN) == LOW;
+  return LocalReportedAlarms() & DEVICE_ALARM_SMOKE;
 }
 
 bool SENSOR_FIRE_Detected()
 {
-  return digitalRead(FIRE_PIN) == HIGH;
+  return LocalReportedAlarms() & DEVICE_ALARM_FIRE;
+}
+
+void SENSOR_GetAlarmEvent(SensorAlarmEvent_st *event)
+{
+  portENTER_CRITICAL(&_alarmMux);
+  *event = _alarmEvent;
+  portEXIT_CRITICAL(&_alarmMux);
+}
+
+void SENSOR_AckAlarm(uint8_t seq)
+{
+  portENTER_CRITICAL(&_alarmMux);
+  _alarmEvent.acked = seq;
+  if (seq == _alarmEvent.seq) {
+    _alarmEvent.latched = 0;
+  }
+  portEXIT_CRITICAL(&_alarmMux);
+}
+
+/* Edges only wake this task, the inputs are read once they have been quiet for SENSOR_DEBOUNCE_MS */
+void alarm_task(void *arg)
+{
+  while (1)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    while (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SENSOR_DEBOUNCE_MS))) {
+    }
+
+    uint32_t edge_ms = _alarmEdgeMs;
+    _alarmEdge = false;
+    uint8_t alarms = LocalReadAlarmPins();
+
+    portENTER_CRITICAL(&_alarmMux);
+    bool changed = (alarms != _alarmEvent.alarms);
+    if (changed) {
+      _alarmEvent.alarms = alarms;
+      _alarmEvent.latched |= alarms;
+      _alarmEvent.seq++;
+      _alarmEvent.ts_ms = edge_ms;
+    }
+    portEXIT_CRITICAL(&_alarmMux);
+
+    if (changed) {
+      _reportNow = (_reportMode & SENSOR_REPORT_ON_ALARM) != 0;
+      log_i("Alarm smoke %d fire %d, %u ms after the edge", (alarms & DEVICE_ALARM_SMOKE) != 0, (alarms & DEVICE_ALARM_FIRE) != 0, millis() - edge_ms);
+    }
+  }
+}
+
+static bool LocalReadReg(uint8_t reg, uint16_t *value)
+{
+  Wire.beginTransmission(INA219_ADDRESS);
+  Wire.write(reg);
+  if (Wire.endTransmission(false) != 0 || Wire.requestFrom((uint8_t)INA219_ADDRESS, (size_t)2) != 2) {
+    return false;
+  }
+
+  uint8_t msb = Wire.read();
+  uint8_t lsb = Wire.read();
+  *value = ((uint16_t)msb << 8) | lsb;
+  return true;
+}
+
+static bool LocalWriteReg(uint8_t reg, uint16_t value)
+{
+  Wire.beginTransmission(INA219_ADDRESS);
+  Wire.write(reg);
+  Wire.write(value >> 8);
+  Wire.write(value & 0xFF);
+  return Wire.endTransmission() == 0;
+}
+
+static uint16_t LocalAdcMode(uint8_t avg)
+{
+  return avg? (INA219_ADC_AVG | avg) : INA219_ADC_12BIT;
+}
+
+/*
+ * Most hardware averaging that still gives a fresh shunt and bus conversion every sample.
+ * The shunt (current) is averaged first, bus voltage gets the most of what is left and
+ * never more than the shunt: 128/32 at 10 Hz, 16/2 at 100 Hz, 8/1 at 200 Hz.
+ */
+static bool LocalConfigure(uint16_t hz)
+{
+  uint32_t period_us = 1000000UL / hz;
+  uint8_t shuntAvg = INA219_ADC_AVG_LOG2_MAX;
+  while (shuntAvg > 0 && (INA219_ADC_CONV_US << shuntAvg) + INA219_ADC_CONV_US > period_us) {
+    shuntAvg--;
+  }
+  uint8_t busAvg = shuntAvg;
+  while (busAvg > 0 && (INA219_ADC_CONV_US << shuntAvg) + (INA219_ADC_CONV_US << busAvg) > period_us) {
+    busAvg--;
+  }
+
+  uint16_t config = INA219_CONFIG_RANGE | (LocalAdcMode(busAvg) << 7) | (LocalAdcMode(shuntAvg) << 3) | INA219_CONFIG_CONTINUOUS;
+  log_i("INA219 %u Hz, %u shunt / %u bus sample averaging", hz, 1 << shuntAvg, 1 << busAvg);
+  Wire.setClock(INA219_I2C_CLOCK);
+  return LocalWriteReg(INA219_REG_CALIBRATION, _calibration) && LocalWriteReg(INA219_REG_CONFIG, config);
+}
+
+static bool LocalFindDevice()
+{
+  if (ina219.begin(&Wire) && LocalConfigure(_sampleHz)) {
+    log_i("INA219 Connected!");
+    return true;
+  }
+  return false;
 }
 
 void SENSOR_Setup()
 {
+  /* The task first, the ISRs notify it */
+  xTaskCreate(alarm_task, "alarm_task", 3072, NULL, 5, &_alarmTask);
   SENSOR_SMOKE_Setup();
   SENSOR_FIRE_Setup();
 
+  /* An input already active at boot is reported like any other change, read once the pulldowns are on */
+  uint8_t alarms = LocalReadAlarmPins();
+  portENTER_CRITICAL(&_alarmMux);
+  _alarmEvent.alarms = alarms;
+  _alarmEvent.latched = alarms;
+  _alarmEvent.seq = alarms? 1 : 0;
+  _alarmEvent.ts_ms = millis();
+  portEXIT_CRITICAL(&_alarmMux);
+
+  /* Stored registers go through the same checks as a remote write, anything off keeps the defaults */
+  _regMutex = xSemaphoreCreateMutex();
+  SensorTuning_st tuning;
+  if (DB_GetSensorTuning(&tuning)) {
+    uint16_t regs[SENSOR_REG_MAX];
+    regs[SENSOR_REG_FULL_mA] = tuning.full_mA;
+    regs[SENSOR_REG_NOTCHARGED_mA] = tuning.notcharged_mA;
+    regs[SENSOR_REG_SAMPLE_HZ] = tuning.sample_hz;
+    regs[SENSOR_REG_REPORT_PERIOD_MS] = tuning.report_period_ms;
+    regs[SENSOR_REG_FILTER_SHIFT] = tuning.filter_shift;
+    regs[SENSOR_REG_REPORT_MODE] = tuning.report_mode;
+    regs[SENSOR_REG_CALIBRATION] = tuning.calibration;
+    if (SENSOR_WriteRegs(0, SENSOR_REG_MAX, regs) != SENSOR_REG_OK) {
+      log_e("Stored sensor registers rejected, using defaults");
+    }
+  }
+  _reconfigure = false;
+
   Wire.setPins(INA219_SDA_PIN, INA219_SCL_PIN);
 
   log_i("Searching for INA219...");
 
-  if (ina219.begin(&Wire)) {
-    log_i("INA219 Connected!");
-    _deviceFound = true;
-  } else {
+  _deviceFound = LocalFindDevice();
+  if ( ! _deviceFound) {
     log_i("INA219 Not found!");
   }
 
-  // To use a slightly lower 32V, 1A range (higher precision on amps):
-  //ina219.setCalibration_32V_1A();
-  // Or to use a lower 16V, 400mA range (higher precision on volts and amps):
-  // ina219.setCalibration_16V_400mA();
-
   xTaskCreate(sensor_task, "sensor_task", 4096, NULL, 1, NULL);
 }
 
@@ -62,49 +322,250 @@ bool SENSOR_IsFound() {
   return _deviceFound;
 }
 
+/* mA in SNAPSHOT_mA_SCALE units, thresholds are whole mA */
+static ChargeState_e LocalClassify(int32_t mA)
+{
+  int32_t full = (int32_t)_fullmA * SNAPSHOT_mA_SCALE;
+  mA = abs(mA);
+
+  if (mA <= (int32_t)_notchargedmA * SNAPSHOT_mA_SCALE) {
+    return CHARGE_STATE_NOT_CHARGING;
+  } else if (mA < full) {
+    return CHARGE_STATE_FULL;
+  } else if (mA < full * SENSOR_TAPER_PCT / 100) {
+    return CHARGE_STATE_TAPERING;
+  }
+  return CHARGE_STATE_CHARGING;
+}
+
+/* Returns true when the reported state changes */
+static bool LocalChargeUpdate(SensorCharge_st *charge, int32_t filtered_mA, int32_t raw_mA)
+{
+  bool changed = false;
+  ChargeState_e candidate = LocalClassify(filtered_mA);
+
+  if (candidate == charge->state) {
+    charge->candidate = candidate;
+  } else if (candidate != charge->candidate) {
+    charge->candidate = candidate;
+    charge->candidate_ms = millis();
+  } else if (millis() - charge->candidate_ms >= SENSOR_CHARGE_DWELL_MS) {
+    log_i("Charge state %d -> %d", charge->state, candidate);
+    charge->state = candidate;
+    _chargeState = candidate;
+    changed = true;
+  }
+
+  charge->total++;
+  if (LocalClassify(raw_mA) == charge->state) {
+    charge->agree++;
+  }
+  return changed;
+}
+
+/*
+ * One coherent sample: the bus register tells whether a new conversion is ready,
+ * then shunt, current and power are read back to back. Reading power clears CNVR,
+ * so bus and shunt are read again: CNVR set, or different bus or shunt data, means
+ * a conversion landed during the reads and the set is taken again. Current and
+ * power are computed from shunt and bus, so equal inputs give equal results.
+ */
+static void LocalSample(SensorEma_st *ema, SensorAccum_st *acc, SensorCharge_st *charge)
+{
+  uint16_t bus, busAfter, shunt, shuntAfter, current, power;
+  uint32_t start = micros();
+
+  if ( ! LocalReadReg(INA219_REG_BUS, &bus)) {
+    acc->errors++;
+    return;
+  }
+  if ( ! (bus & INA219_BUS_CNVR)) {
+    acc->not_ready++;
+    return;
+  }
+
+  for (uint8_t attempt = 1; ; attempt++) {
+    if ( ! LocalReadReg(INA219_REG_SHUNT, &shunt) || ! LocalReadReg(INA219_REG_CURRENT, &current) ||
+         ! LocalReadReg(INA219_REG_POWER, &power) || ! LocalReadReg(INA219_REG_BUS, &busAfter) ||
+         ! LocalReadReg(INA219_REG_SHUNT, &shuntAfter)) {
+      acc->errors++;
+      return;
+    }
+    if ( ! (busAfter & INA219_BUS_CNVR) && (busAfter >> 3) == (bus >> 3) && shuntAfter == shunt) {
+      break;
+    }
+    if (attempt >= SENSOR_SAMPLE_ATTEMPTS) {
+      acc->torn++;
+      return;
+    }
+    bus = busAfter;
+  }
+
+  /* Out of range is still a reading, kept and counted as clipped rather than as a bus error */
+  if (bus & INA219_BUS_OVF) {
+    acc->overflows++;
+  }
+
+  uint32_t i2c_us = micros() - start;
+  acc->sum_i2c_us += i2c_us;
+  if (i2c_us > acc->max_i2c_us) {
+    acc->max_i2c_us = i2c_us;
+  }
+
+  /* Current LSB is 0.1 mA (SNAPSHOT_mA_SCALE), shunt 10 uV, bus 4 mV in bits 15..3 */
+  int32_t mA = (int16_t)current;
+  int32_t mV = (bus >> 3) * 4;
+  acc->sum_mW += power * INA219_POWER_mW_LSB;
+  _shuntvoltage = (int16_t)shunt * 0.01f;
+
+  if ( ! ema->seeded) {
+    ema->mA = mA << SENSOR_EMA_FRAC;
+    ema->mV = mV << SENSOR_EMA_FRAC;
+    ema->seeded = true;
+  }
+  uint8_t shift = _filterShift;
+  ema->mA += ((mA << SENSOR_EMA_FRAC) - ema->mA) >> shift;
+  ema->mV += ((mV << SENSOR_EMA_FRAC) - ema->mV) >> shift;
+
+  if (LocalChargeUpdate(charge, ema->mA >> SENSOR_EMA_FRAC, mA) && (_reportMode & SENSOR_REPORT_ON_CHARGE)) {
+    _reportNow = true;
+  }
+
+  if (acc->samples == 0 || mA < acc->min_mA) {
+    acc->min_mA = mA;
+  }
+  if (acc->samples == 0 || mA > acc->max_mA) {
+    acc->max_mA = mA;
+  }
+  acc->sum_mA += mA;
+  acc->sum_mV += mV;
+  acc->samples++;
+}
+
+/* Publishes the filtered reading and the window's statistics, then starts a new window */
+static void LocalCloseWindow(const SensorEma_st *ema, SensorAccum_st *acc)
+{
+  SensorWindow_st window = { 0 };
+  if (acc->samples) {
+    window.mean_mA = (float)acc->sum_mA / acc->samples / SNAPSHOT_mA_SCALE;
+    window.min_mA = (float)acc->min_mA / SNAPSHOT_mA_SCALE;
+    window.max_mA = (float)acc->max_mA / SNAPSHOT_mA_SCALE;
+    window.mean_V = (float)acc->sum_mV / acc->samples / SNAPSHOT_mV_SCALE;
+    window.mean_mW = (float)acc->sum_mW / acc->samples;
+    window.i2c_us_mean = acc->sum_i2c_us / acc->samples;
+    window.i2c_us_max = acc->max_i2c_us;
+    window.samples = acc->samples;
+
+    _current_mA = (float)ema->mA / (1 << SENSOR_EMA_FRAC) / SNAPSHOT_mA_SCALE;
+    _busvoltage = (float)ema->mV / (1 << SENSOR_EMA_FRAC) / SNAPSHOT_mV_SCALE;
+  }
+  window.not_ready = acc->not_ready;
+  window.torn = acc->torn;
+  window.overflows = acc->overflows;
+  window.errors = acc->errors;
+
+  portENTER_CRITICAL(&_windowMux);
+  _window = window;
+  portEXIT_CRITICAL(&_windowMux);
+
+  log_i("Bus Vol: %.3f, Current: %.3f (mean %.3f, min %.3f, max %.3f, %u samples, %u clipped, %u torn, %u errors), I2C %u/%u us",
+        _busvoltage, _current_mA, window.mean_mA, window.min_mA, window.max_mA, window.samples, window.overflows, window.torn,
+        window.errors, window.i2c_us_mean, window.i2c_us_max);
+
+  memset(acc, 0, sizeof(SensorAccum_st));
+}
+
+/* Hands the latest reading to the transport, right after an alarm change or at the end of a window */
+static void LocalReport(bool windowClosed)
+{
+  SensorAlarmEvent_st event;
+  SENSOR_GetAlarmEvent(&event);
+  uint8_t reported = event.alarms | event.latched;
+  uint8_t alarms = DEVICE_ALARM_VALID | reported;
+  if (_deviceFound) {
+    alarms |= DEVICE_CHARGE_VALID | (_chargeState << DEVICE_CHARGE_SHIFT);
+  }
+
+#if (CONFIG_WIRED == 1)
+  /* The host acknowledges over RS485 after its alarm scan */
+  UART_UpdateSensorReply(_current_mA, _busvoltage, reported & DEVICE_ALARM_SMOKE, reported & DEVICE_ALARM_FIRE, _chargeState, _chargeConfidence);
+#endif
+
+#if (CONFIG_DEVICE_TABLE == 1)
+  /* The master's own locker reaches the TCP host through the device table, under the id the host knows it by */
+  #if (CONFIG_WIRED == 1)
+  DEVICES_UpdateInfo((DeviceId_t)DB_GetDeviceId(), _current_mA, _busvoltage, alarms);
+  #else
+  DEVICES_UpdateInfo(CONFIG_MASTER_DEVICE_ID, _current_mA, _busvoltage, alarms);
+  #endif
+#endif
+
+#if (CONFIG_WIRELESS == 1)
+  #if defined(DEVICE_TYPE_SLAVE)
+  EspNowTelemetry_st msg;
+  msg.type = ESPNOW_MSG_TELEMETRY;
+  msg.version = ESPNOW_MSG_VERSION;
+  msg.id = DB_GetDeviceId();
+  msg.alarms = alarms;
+  msg.mA = lroundf(_current_mA * SNAPSHOT_mA_SCALE);
+  msg.mV = (uint16_t)constrain(lroundf(_busvoltage * SNAPSHOT_mV_SCALE), 0, UINT16_MAX);
+  WIRELESS_Broadcast((const uint8_t *)&msg, sizeof(msg));
+  #endif
+
+  /* No ack path back from the server, a latched pulse rides on the immediate report and one periodic one */
+  if (windowClosed) {
+    SENSOR_AckAlarm(event.seq);
+  }
+#endif
+}
+
 void sensor_task(void *arg)
 {
+  SensorEma_st ema = { 0 };
+  SensorAccum_st acc = { 0 };
+  SensorCharge_st charge = { CHARGE_STATE_NOT_CHARGING, CHARGE_STATE_NOT_CHARGING, 0, 0, 0 };
+  uint32_t windowStart = millis();
+  TickType_t wake = xTaskGetTickCount();
+
   while (1)
   {
     if (_deviceFound)
     {
-      _shuntvoltage = ina219.getShuntVoltage_mV();
-      _busvoltage = ina219.getBusVoltage_V();
-      _current_mA = ina219.getCurrent_mA();
-      log_i("Bus Vol: %.3f, Shunt Vol: %.3f, Current: %.3f", _busvoltage, _shuntvoltage, _current_mA);
-#if 0
-      float loadvoltage = 0;
-      float power_mW = 0;
-      power_mW = ina219.getPower_mW();
-      loadvoltage = _busvoltage + (_shuntvoltage / 1000);
-      Serial.print("Load Voltage:  "); Serial.print(loadvoltage); Serial.println(" V");
-      Serial.print("Power:         "); Serial.print(power_mW); Serial.println(" mW");
-      Serial.println("");
-#endif
-    }
-    else
-    {
-      if (ina219.begin(&Wire)) {
-        log_i("INA219 Connected!");
-        _deviceFound = true;
+      if (_reconfigure) {
+        _reconfigure = false;
+        LocalConfigure(_sampleHz);
       }
+      LocalSample(&ema, &acc, &charge);
     }
 
-#if (CONFIG_WIRELESS == 1)
-  #if defined(DEVICE_TYPE_SLAVE)
-      String msg = ("{\"id\":" + String(DB_GetDeviceId()) +
-                    ",\"mA\":" + String(_current_mA, 2) +
-                    ",\"V\":" + String(_busvoltage) +
-                    "}");
-      WIRELESS_Broadcast(msg);
-  #endif
+    if (millis() - windowStart >= _samplePeriodMs)
+    {
+      windowStart = millis();
 
-  #if defined(DEVICE_TYPE_MASTER)
-      DEVICES_UpdateInfo(CONFIG_MASTER_DEVICE_ID, _current_mA, _busvoltage);
-  #endif
-#endif
+      if (_deviceFound && acc.samples == 0 && acc.errors) {
+        log_e("INA219 not responding");
+        _deviceFound = false;
+        ema.seeded = false;
+      } else if ( ! _deviceFound) {
+        _reconfigure = false;
+        _deviceFound = LocalFindDevice();
+      }
 
-    vTaskDelay(pdMS_TO_TICKS(2000));
+      LocalCloseWindow(&ema, &acc);
+      _chargeConfidence = charge.total? (uint8_t)(charge.agree * 100UL / charge.total) : 0;
+      charge.agree = 0;
+      charge.total = 0;
+      _reportNow = false;
+      LocalReport(true);
+    }
+    else if (_reportNow)
+    {
+      _reportNow = false;
+      LocalReport(false);
+    }
+
+    TickType_t period = pdMS_TO_TICKS(1000 / _sampleHz);
+    vTaskDelayUntil(&wake, period? period : 1);
   }
 }
 
@@ -117,3 +578,101 @@ float SENSOR_GetVoltage(void)
 {
   return _busvoltage;
 }
+
+void SENSOR_GetWindow(SensorWindow_st *window)
+{
+  portENTER_CRITICAL(&_windowMux);
+  *window = _window;
+  portEXIT_CRITICAL(&_windowMux);
+}
+
+ChargeState_e SENSOR_GetChargeState(uint8_t *confidence)
+{
+  if (confidence) {
+    *confidence = _chargeConfidence;
+  }
+  return _chargeState;
+}
+
+static uint16_t LocalRegGet(uint8_t reg)
+{
+  switch (reg)
+  {
+    case SENSOR_REG_FULL_mA:          return _fullmA;
+    case SENSOR_REG_NOTCHARGED_mA:    return _notchargedmA;
+    case SENSOR_REG_SAMPLE_HZ:        return _sampleHz;
+    case SENSOR_REG_REPORT_PERIOD_MS: return _samplePeriodMs;
+    case SENSOR_REG_FILTER_SHIFT:     return _filterShift;
+    case SENSOR_REG_REPORT_MODE:      return _reportMode;
+    case SENSOR_REG_CALIBRATION:      return _calibration;
+    default: return 0;
+  }
+}
+
+SensorRegStatus_e SENSOR_ReadRegs(uint8_t start, uint8_t count, uint16_t *values)
+{
+  if (count == 0 || start + count > SENSOR_REG_MAX) {
+    return SENSOR_REG_ERR_ADDRESS;
+  }
+
+  for (uint8_t i = 0; i < count; i++) {
+    values[i] = LocalRegGet(start + i);
+  }
+  return SENSOR_REG_OK;
+}
+
+/* All or nothing: every value is checked before any register changes. RAM only, see SENSOR_SaveRegs() */
+SensorRegStatus_e SENSOR_WriteRegs(uint8_t start, uint8_t count, const uint16_t *values)
+{
+  uint16_t regs[SENSOR_REG_MAX];
+
+  if (count == 0 || start + count > SENSOR_REG_MAX) {
+    return SENSOR_REG_ERR_ADDRESS;
+  }
+  if (_regMutex == NULL) {
+    return SENSOR_REG_ERR_VALUE;
+  }
+
+  xSemaphoreTake(_regMutex, portMAX_DELAY);
+  SENSOR_ReadRegs(0, SENSOR_REG_MAX, regs);
+  for (uint8_t i = 0; i < count; i++) {
+    uint8_t reg = start + i;
+    if (values[i] < _regRange[reg].min || _regRange[reg].max < values[i]) {
+      xSemaphoreGive(_regMutex);
+      return SENSOR_REG_ERR_VALUE;
+    }
+    regs[reg] = values[i];
+  }
+  if (regs[SENSOR_REG_NOTCHARGED_mA] >= regs[SENSOR_REG_FULL_mA]) {
+    xSemaphoreGive(_regMutex);
+    return SENSOR_REG_ERR_VALUE;
+  }
+
+  bool reconfigure = (regs[SENSOR_REG_SAMPLE_HZ] != _sampleHz) || (regs[SENSOR_REG_CALIBRATION] != _calibration);
+  _fullmA = regs[SENSOR_REG_FULL_mA];
+  _notchargedmA = regs[SENSOR_REG_NOTCHARGED_mA];
+  _samplePeriodMs = regs[SENSOR_REG_REPORT_PERIOD_MS];
+  _sampleHz = regs[SENSOR_REG_SAMPLE_HZ];
+  _filterShift = regs[SENSOR_REG_FILTER_SHIFT];
+  _reportMode = regs[SENSOR_REG_REPORT_MODE];
+  _calibration = regs[SENSOR_REG_CALIBRATION];
+  if (reconfigure) {
+    _reconfigure = true;
+  }
+  xSemaphoreGive(_regMutex);
+
+  return SENSOR_REG_OK;
+}
+
+/* One NVS commit for all registers, callers answer the bus first since this can take a while */
+void SENSOR_SaveRegs()
+{
+  if (_regMutex == NULL) {
+    return;
+  }
+
+  xSemaphoreTake(_regMutex, portMAX_DELAY);
+  SensorTuning_st tuning = { _fullmA, _notchargedmA, _sampleHz, (uint16_t)_samplePeriodMs, _filterShift, _reportMode, _calibration };
+  DB_SetSensorTuning(&tuning);
+  xSemaphoreGive(_regMutex);
+}
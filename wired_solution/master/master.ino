@@ -3,12 +3,36 @@
 void setup(void) 
 {
   Serial.begin(115200);
+  DB_Init();
 
   /* LED */
   LED_Init();
   log_i("Device ID: %d", DB_GetDeviceId());
+
+#if (CONFIG_DEVICE_TABLE == 1)
+  DEVICES_Init();
+#endif
+
+#if (CONFIG_WIRELESS == 1) && defined(DEVICE_TYPE_SLAVE)
+  /* Slaves report over ESP-NOW and find the master's channel on their own, the radio comes up before the first report */
+  WIRELESS_Init();
+#endif
+
+  /* The RS485 node keeps answering the bus while WiFi connects or sits in AP mode */
   UART_Init();
   SENSOR_Setup();
+
+#if (CONFIG_DEVICE_TABLE == 1)
+  /* Snapshots, history and the command channel go to the host over TCP */
+  WIFI_Init();
+  if (WiFi.getMode() == WIFI_AP) {
+    return;
+  }
+
+  #if (CONFIG_WIRELESS == 1)
+  WIRELESS_Init();
+  #endif
+#endif
 }
 
 void loop(void) 
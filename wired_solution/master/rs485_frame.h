@@ -0,0 +1,206 @@
+#pragma once
+/*
+ * RS485 framing codec, header only and free of Arduino headers.
+ *
+ *   STX | LEN | ADDR (ADDR_LEN bytes) | PAYLOAD | CRC (CRC::SIZE bytes) | ETX
+ *
+ * LEN counts everything between LEN and ETX: address, payload and CRC.
+ * The CRC covers LEN, address and payload. Address and CRC are sent high
+ * byte first.
+ *
+ * Encoding writes into a caller buffer. Decoding is a byte at a time state
+ * machine writing the payload into a caller attached buffer, so neither
+ * direction touches the heap.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "crc16.h"
+
+#define RS485_FRAME_STX                       0x02
+#define RS485_FRAME_ETX                       0x03
+#define RS485_FRAME_LEN_MAX                   0xFF    //LEN is a single byte
+
+typedef enum {
+  RS485_RX_IDLE = (0),          //Byte outside of a frame, dropped
+  RS485_RX_BUSY,                //Byte consumed, frame in progress
+  RS485_RX_FRAME,               //Frame complete, CRC and ETX verified
+  RS485_RX_ERR_LEN,
+  RS485_RX_ERR_NO_BUFFER,
+  RS485_RX_ERR_CRC,
+  RS485_RX_ERR_ETX,
+} Rs485RxResult_e;
+
+struct Crc16ModbusPolicy {
+  static constexpr size_t SIZE = 2;
+
+  static uint32_t Init() { return CRC16_INIT; }
+  static uint32_t Update(uint32_t crc, uint8_t data) { return CRC16_Update(crc, data); }
+  static uint32_t UpdateBlock(uint32_t crc, const uint8_t *data, size_t len) { return CRC16_UpdateBlock(crc, data, len); }
+};
+
+template <size_t ADDR_LEN, class CRC = Crc16ModbusPolicy>
+class Rs485Frame
+{
+  static_assert(ADDR_LEN <= sizeof(uint32_t), "Address must fit in 32 bits");
+  static_assert(CRC::SIZE <= sizeof(uint32_t), "CRC must fit in 32 bits");
+
+public:
+  static constexpr size_t OVERHEAD = 3 /* STX, LEN, ETX */ + ADDR_LEN + CRC::SIZE;
+  static constexpr size_t MAX_PAYLOAD = RS485_FRAME_LEN_MAX - ADDR_LEN - CRC::SIZE;
+  static constexpr size_t MAX_FRAME = OVERHEAD + MAX_PAYLOAD;
+
+  /* Returns the frame length, or 0 if the payload or output buffer does not fit */
+  static size_t Encode(uint8_t *out, size_t out_size, uint32_t addr, const uint8_t *payload, size_t payload_len)
+  {
+    if (out == nullptr || payload_len > MAX_PAYLOAD || out_size < payload_len + OVERHEAD) {
+      return 0;
+    }
+
+    size_t pos = 0;
+    out[pos++] = RS485_FRAME_STX;
+    out[pos++] = (uint8_t)(ADDR_LEN + payload_len + CRC::SIZE);
+    for (size_t i = ADDR_LEN; i > 0; i--) {
+      out[pos++] = (uint8_t)(addr >> (8 * (i - 1)));
+    }
+    if (payload_len) {
+      memcpy(&out[pos], payload, payload_len);
+      pos += payload_len;
+    }
+
+    uint32_t crc = CRC::UpdateBlock(CRC::Init(), &out[1], pos - 1);
+    for (size_t i = CRC::SIZE; i > 0; i--) {
+      out[pos++] = (uint8_t)(crc >> (8 * (i - 1)));
+    }
+    out[pos++] = RS485_FRAME_ETX;
+
+    return pos;
+  }
+
+  class Decoder
+  {
+  public:
+    /* Payload buffer for the next frame. May be changed whenever IsIdle() */
+    void Attach(uint8_t *buf, size_t size)
+    {
+      _buf = buf;
+      _size = buf ? size : 0;
+    }
+
+    void Reset() { _state = STATE_IDLE; }
+    bool IsIdle() const { return _state == STATE_IDLE; }
+
+    /* Valid after Feed() returned RS485_RX_FRAME */
+    uint32_t Address() const { return _addr; }
+    size_t PayloadLen() const { return _payloadLen; }
+
+    Rs485RxResult_e Feed(uint8_t data)
+    {
+      switch (_state)
+      {
+        case STATE_IDLE:
+          if (data != RS485_FRAME_STX) {
+            return RS485_RX_IDLE;
+          }
+          _state = STATE_LEN;
+          break;
+
+        case STATE_LEN:
+          _state = STATE_IDLE;
+          if (data == 0 || data < ADDR_LEN + CRC::SIZE) {
+            return RS485_RX_ERR_LEN;
+          }
+
+          _payloadLen = data - ADDR_LEN - CRC::SIZE;
+          if (_payloadLen > 0 && _buf == nullptr) {
+            return RS485_RX_ERR_NO_BUFFER;
+          } else if (_payloadLen > _size) {
+            return RS485_RX_ERR_LEN;
+          }
+
+          _crc = CRC::Update(CRC::Init(), data);
+          _addr = 0;
+          _recvCrc = 0;
+          _cnt = 0;
+          _state = STATE_ADDR;
+          LocalSkipEmpty();
+          break;
+
+        case STATE_ADDR:
+          _crc = CRC::Update(_crc, data);
+          _addr = (_addr << 8) | data;
+          if (++_cnt >= ADDR_LEN) {
+            _cnt = 0;
+            _state = STATE_DATA;
+            LocalSkipEmpty();
+          }
+          break;
+
+        case STATE_DATA:
+          _crc = CRC::Update(_crc, data);
+          _buf[_cnt] = data;
+          if (++_cnt >= _payloadLen) {
+            _cnt = 0;
+            _state = STATE_CRC;
+            LocalSkipEmpty();
+          }
+          break;
+
+        case STATE_CRC:
+          _recvCrc = (_recvCrc << 8) | data;
+          if (++_cnt >= CRC::SIZE) {
+            _state = STATE_ETX;
+          }
+          break;
+
+        case STATE_ETX:
+          _state = STATE_IDLE;
+          if (data != RS485_FRAME_ETX) {
+            return RS485_RX_ERR_ETX;
+          } else if (_recvCrc != _crc) {
+            return RS485_RX_ERR_CRC;
+          }
+          return RS485_RX_FRAME;
+
+        default:
+          _state = STATE_IDLE;
+          return RS485_RX_IDLE;
+      }
+
+      return RS485_RX_BUSY;
+    }
+
+  private:
+    typedef enum {
+      STATE_IDLE = (0),
+      STATE_LEN,
+      STATE_ADDR,
+      STATE_DATA,
+      STATE_CRC,
+      STATE_ETX,
+    } State_e;
+
+    /* Step over address, payload or CRC fields that are zero length */
+    void LocalSkipEmpty()
+    {
+      if (_state == STATE_ADDR && ADDR_LEN == 0) {
+        _state = STATE_DATA;
+      }
+      if (_state == STATE_DATA && _payloadLen == 0) {
+        _state = STATE_CRC;
+      }
+      if (_state == STATE_CRC && CRC::SIZE == 0) {
+        _state = STATE_ETX;
+      }
+    }
+
+    State_e _state = STATE_IDLE;
+    uint8_t *_buf = nullptr;
+    size_t _size = 0;
+    size_t _payloadLen = 0;
+    size_t _cnt = 0;
+    uint32_t _addr = 0;
+    uint32_t _crc = 0;
+    uint32_t _recvCrc = 0;
+  };
+};
@@ -0,0 +1,179 @@
+#pragma once
+/*
+ * Device snapshot stream from the master to the server over TCP.
+ *
+ *   MAGIC ("LK") | VERSION | FLAGS | SEQ | LEN | RECORDS (LEN bytes) | CRC
+ *
+ * SEQ, LEN and CRC are 16 bit little endian, as are all record values.
+ * The CRC16-Modbus covers VERSION through the last record byte.
+ *
+ * Records are TYPE | LEN | VALUE. A TIMESTAMP stamps the whole snapshot.
+ * Readers skip record types they don't know, so new types don't need a
+ * version bump.
+ *
+ * Devices go out as DEVICES_PACKED records, back to back
+ *
+ *   ID | FLAGS | zigzag varint mA*10 | zigzag varint mV | varint age ms
+ *
+ * On a keyframe the values are absolute. Other frames carry BASE_SEQ and the
+ * values are deltas against that keyframe, unless the ABSOLUTE flag is set
+ * for a device the keyframe did not have. A receiver that missed the
+ * keyframe drops deltas until the next one, so a lost delta frame never
+ * corrupts state.
+ *
+ * Only the master's writer side lives here, the server parses the stream.
+ * Like rs485_frame.h this is free of Arduino headers and never allocates.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "crc16.h"
+
+#define SNAPSHOT_MAGIC_0                      'L'
+#define SNAPSHOT_MAGIC_1                      'K'
+#define SNAPSHOT_VERSION                      2
+#define SNAPSHOT_HEADER_SIZE                  8
+#define SNAPSHOT_CRC_SIZE                     2
+#define SNAPSHOT_OVERHEAD                     (SNAPSHOT_HEADER_SIZE + SNAPSHOT_CRC_SIZE)
+#define SNAPSHOT_LEN_MAX                      0xFFFF
+#define SNAPSHOT_RECORD_OVERHEAD              2       //TYPE, LEN
+
+#define SNAPSHOT_FLAG_KEYFRAME                0x01    //Every known device is in this snapshot
+#define SNAPSHOT_FLAG_HISTORY                 0x02    //Reply to a history query, not a live snapshot
+
+#define SNAPSHOT_mA_SCALE                     10      //Fixed point 0.1 mA
+#define SNAPSHOT_mV_SCALE                     1000    //Fixed point 1 mV
+#define SNAPSHOT_PACKED_DEVICE_MAX            17      //ID, FLAGS, 5 byte varints x3
+#define SNAPSHOT_HISTORY_SAMPLE_MAX           15      //5 byte varints x3
+
+#define SNAPSHOT_PACKED_SMOKE                 0x01
+#define SNAPSHOT_PACKED_FIRE                  0x02
+#define SNAPSHOT_PACKED_ALARM_VALID           0x04    //SMOKE and FIRE bits are meaningful
+#define SNAPSHOT_PACKED_CHARGE_VALID          0x08    //CHARGE bits are meaningful
+#define SNAPSHOT_PACKED_CHARGE_SHIFT          4       //2 bit charge state: not charging, charging, full, tapering
+#define SNAPSHOT_PACKED_CHARGE_MASK           0x30
+#define SNAPSHOT_PACKED_ABSOLUTE              0x80    //Not a delta, even in a non keyframe
+
+typedef enum {
+  SNAPSHOT_REC_TIMESTAMP = (0x01),      //u32, ms since boot
+  SNAPSHOT_REC_BASE_SEQ = (0x03),       //u16, keyframe the packed deltas are against
+  SNAPSHOT_REC_DEVICES_PACKED = (0x20), //SnapshotPackedDevice_st entries
+  SNAPSHOT_REC_HISTORY_QUERY = (0x30),  //u8 id, u8 tier, u32 from s, u32 to s
+  SNAPSHOT_REC_HISTORY_SAMPLES = (0x31),//varint ts s (delta to the previous), zigzag varint mA, varint mV
+} SnapshotRecord_e;
+
+typedef struct {
+  uint8_t id;
+  uint8_t flags;
+  int32_t mA;       //SNAPSHOT_mA_SCALE units, absolute or delta
+  int32_t mV;
+  uint32_t age_ms;  //Time since the device last reported
+} SnapshotPackedDevice_st;
+
+inline uint32_t SNAPSHOT_ZigZag(int32_t value)
+{
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+inline size_t SNAPSHOT_PutVarint(uint8_t *p, uint32_t value)
+{
+  size_t len = 0;
+  while (value >= 0x80) {
+    p[len++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  p[len++] = (uint8_t)value;
+  return len;
+}
+
+/* Out must have SNAPSHOT_PACKED_DEVICE_MAX bytes. Returns the bytes written */
+inline size_t SNAPSHOT_PackDevice(uint8_t *out, const SnapshotPackedDevice_st *dev)
+{
+  size_t len = 0;
+  out[len++] = dev->id;
+  out[len++] = dev->flags;
+  len += SNAPSHOT_PutVarint(&out[len], SNAPSHOT_ZigZag(dev->mA));
+  len += SNAPSHOT_PutVarint(&out[len], SNAPSHOT_ZigZag(dev->mV));
+  len += SNAPSHOT_PutVarint(&out[len], dev->age_ms);
+  return len;
+}
+
+class SnapshotWriter
+{
+public:
+  SnapshotWriter(uint8_t *buf, size_t size) : _buf(buf), _size(size) {}
+
+  void Begin(uint16_t seq, uint8_t flags)
+  {
+    _pos = SNAPSHOT_HEADER_SIZE;
+    _overflow = (_buf == nullptr || _size < SNAPSHOT_OVERHEAD);
+    if (_overflow) {
+      return;
+    }
+
+    _buf[0] = SNAPSHOT_MAGIC_0;
+    _buf[1] = SNAPSHOT_MAGIC_1;
+    _buf[2] = SNAPSHOT_VERSION;
+    _buf[3] = flags;
+    LocalPutU16(&_buf[4], seq);
+  }
+
+  bool Add(uint8_t type, const uint8_t *value, uint8_t len)
+  {
+    if (_overflow || _pos + SNAPSHOT_RECORD_OVERHEAD + len + SNAPSHOT_CRC_SIZE > _size ||
+        _pos + SNAPSHOT_RECORD_OVERHEAD + len - SNAPSHOT_HEADER_SIZE > SNAPSHOT_LEN_MAX) {
+      _overflow = true;
+      return false;
+    }
+
+    _buf[_pos++] = type;
+    _buf[_pos++] = len;
+    if (len) {
+      memcpy(&_buf[_pos], value, len);
+      _pos += len;
+    }
+    return true;
+  }
+
+  bool AddU8(uint8_t type, uint8_t value) { return Add(type, &value, sizeof(value)); }
+
+  bool AddU16(uint8_t type, uint16_t value)
+  {
+    uint8_t le[2] = { (uint8_t)value, (uint8_t)(value >> 8) };
+    return Add(type, le, sizeof(le));
+  }
+
+  bool AddU32(uint8_t type, uint32_t value)
+  {
+    uint8_t le[4] = { (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
+    return Add(type, le, sizeof(le));
+  }
+
+  /* Bytes of records written so far */
+  size_t RecordsLen() const { return _pos - SNAPSHOT_HEADER_SIZE; }
+
+  /* Returns the frame length, or 0 if any record did not fit */
+  size_t Finish()
+  {
+    if (_overflow) {
+      return 0;
+    }
+
+    LocalPutU16(&_buf[6], (uint16_t)RecordsLen());
+    uint16_t crc = CRC16_Calculate(&_buf[2], _pos - 2);
+    LocalPutU16(&_buf[_pos], crc);
+    return _pos + SNAPSHOT_CRC_SIZE;
+  }
+
+private:
+  static void LocalPutU16(uint8_t *p, uint16_t value)
+  {
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+  }
+
+  uint8_t *_buf;
+  size_t _size;
+  size_t _pos = 0;
+  bool _overflow = true;
+};
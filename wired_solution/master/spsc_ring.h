@@ -0,0 +1,113 @@
+#pragma once
+/*
+ * Lock free single producer / single consumer ring with inline slots.
+ *
+ * Exactly one context pushes (a task, the Wi-Fi or AsyncTCP callback) and
+ * exactly one task pops. Producer and consumer indices sit on separate
+ * cache lines, each side keeping a cached copy of the other's index so
+ * the shared line is only read when the ring looks full or empty.
+ *
+ * A push into a full ring fails and is counted in Dropped(), data the
+ * consumer has not seen is never overwritten. HighWater() is the deepest
+ * the ring has been, to size it from the field.
+ *
+ * Free of Arduino headers and never allocates.
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#ifndef SPSC_CACHE_LINE
+#define SPSC_CACHE_LINE                       32
+#endif
+
+template <class T, size_t N>
+class SpscRing
+{
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "Ring size must be a power of two");
+
+public:
+  /* Producer: slot to fill in place, or nullptr (and a drop) when full */
+  T *PushBegin()
+  {
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    if (head - _tailCache >= N) {
+      _tailCache = _tail.load(std::memory_order_acquire);
+      if (head - _tailCache >= N) {
+        _dropped.store(_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return nullptr;
+      }
+    }
+    return &_slots[head & (N - 1)];
+  }
+
+  /* Producer: publish the slot returned by PushBegin() */
+  void PushCommit()
+  {
+    uint32_t head = _head.load(std::memory_order_relaxed) + 1;
+    _head.store(head, std::memory_order_release);
+
+    uint32_t depth = head - _tailCache;
+    if (depth > _highWater.load(std::memory_order_relaxed)) {
+      _highWater.store(depth, std::memory_order_relaxed);
+    }
+  }
+
+  bool Push(const T &item)
+  {
+    T *slot = PushBegin();
+    if (slot == nullptr) {
+      return false;
+    }
+    *slot = item;
+    PushCommit();
+    return true;
+  }
+
+  /* Consumer: oldest slot, or nullptr when empty. Valid until PopCommit() */
+  T *PopBegin()
+  {
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail == _headCache) {
+      _headCache = _head.load(std::memory_order_acquire);
+      if (tail == _headCache) {
+        return nullptr;
+      }
+    }
+    return &_slots[tail & (N - 1)];
+  }
+
+  void PopCommit()
+  {
+    _tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  bool Pop(T *item)
+  {
+    T *slot = PopBegin();
+    if (slot == nullptr) {
+      return false;
+    }
+    *item = *slot;
+    PopCommit();
+    return true;
+  }
+
+  size_t Size() const { return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire); }
+  static constexpr size_t Capacity() { return N; }
+  uint32_t HighWater() const { return _highWater.load(std::memory_order_relaxed); }
+  uint32_t Dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+private:
+  /* Producer line */
+  alignas(SPSC_CACHE_LINE) std::atomic<uint32_t> _head{0};
+  uint32_t _tailCache = 0;
+  std::atomic<uint32_t> _highWater{0};
+  std::atomic<uint32_t> _dropped{0};
+
+  /* Consumer line */
+  alignas(SPSC_CACHE_LINE) std::atomic<uint32_t> _tail{0};
+  uint32_t _headCache = 0;
+
+  alignas(SPSC_CACHE_LINE) T _slots[N];
+};
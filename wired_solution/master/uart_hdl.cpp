@@ -2,26 +2,32 @@
 
 #define RS485_RX                  3
 #define RS485_TX                  4
+#define RS485_DE                  10      //Driver enable on RTS, UART_PIN_NO_CHANGE for auto direction transceivers
 
 #define UART_PORT                 UART_NUM_1
 #define UART_BUFF_SIZE            1024
 #define UART_FRAME_TIMEOUT        100
+#define UART_RX_TOUT              3       //symbols of idle line before the driver posts UART_DATA
 #define UART_PROTOCOL_BROADCAST   0x00
+#define UART_PROTOCOL_ADDR_LEN    1       //bytes
 
-#define STX                       0x02
-#define ETX                       0x03
-#define UART_PROTOCOL_CRC_LEN     2       //bytes
+#define UART_DEFAULT_BAUDRATE     CONFIG_RS485_BAUDRATE
+#define UART_BAUD_SWITCH_DELAY    300     //ms after SET_BAUDRATE, leaves room for the ack train
+#define UART_BAUD_ERR_WINDOW      2000    //ms
+#define UART_BAUD_ERR_LIMIT       8       //errors per window before falling back to the default rate
 
-typedef enum {
-  UART_STATE_IDLE = (0),
-  UART_STATE_LEN,
-  UART_STATE_DATA,
-  UART_STATE_ETX,
-} UartStates_e;
+#define UART_REPLY_FIRST_ID       1
+#define UART_REPLY_SLOT_GUARD     2       //ms of skew between nodes on top of a reply's air time
+
+#define UART_REG_COUNT_MAX        16      //Registers per REGISTERS request
 
 typedef enum {
   UART_CMD_GET_CURRENT_mA = (0),
   UART_CMD_SET_THRESHOLD,
+  UART_CMD_SET_BAUDRATE,
+  UART_CMD_GET_ALARM,
+  UART_CMD_ACK_ALARM,
+  UART_CMD_REGISTERS,
 } UartCmds_e;
 
 typedef enum {
@@ -29,101 +35,175 @@ typedef enum {
   UART_TYPE_WRITE
 } UartTypes_e;
 
+/* STX - LEN - ID - (DATA) - CRC_H - CRC_L - ETX */
+typedef Rs485Frame<UART_PROTOCOL_ADDR_LEN> UartCodec;
+
+typedef struct {
+  uint8_t id;
+  uint16_t len;
+  uint8_t data[UartCodec::MAX_PAYLOAD];
+} UartFrame_st;
+
+#define UART_SENSOR_REPLY_LEN     (sizeof(float) * 2 + 4)   //mA(float) + vol(float) + smoke(bool) + fire(bool) + charge state + confidence(%)
+#define UART_ACK_REPLY_LEN        2                         //CMD + OK
+#define UART_ALARM_REPLY_LEN      6                         //CMD + alarms + latched + seq + age(u16)
+#define UART_REG_REPLY_LEN        5                         //CMD + type + start + count + status, read values follow
+
+/* GET_CURRENT_mA reply, encoded and CRC stamped whenever a new sample lands */
+typedef struct {
+  uint8_t frame[UartCodec::OVERHEAD + UART_SENSOR_REPLY_LEN];
+  uint8_t len;
+  bool smoke;
+  bool fire;
+} UartSensorReply_st;
+
 static QueueHandle_t _uartQueue;
-static UartStates_e _uartState = UART_STATE_IDLE;
-
-static void LocalHandleIncommingData(uint8_t *data, uint16_t data_len);
-
-uint16_t LocalCalculateCrc16(uint8_t *data, uint16_t data_len) {
-  uint16_t crc = 0xFFFF;
-  for (size_t i = 0; i < data_len; i++) {
-    crc ^= data[i];
-    for (int j = 0; j < 8; j++) {
-      if (crc & 0x0001) {
-        crc >>= 1;
-        crc ^= 0xA001;
-      } else {
-        crc >>= 1;
-      }
-    }
+static UartCodec::Decoder _uartRx;
+
+/* Frames are handled on uart_event_task before the next byte is fed, one static buffer is enough */
+static UartFrame_st _uartFrame;
+static UartStats_st _uartStats = { 0 };
+
+static uint32_t _uartBaudrate = UART_DEFAULT_BAUDRATE;
+static bool _uartBaudVerified = true;
+static unsigned long _uartErrWindowStart = 0;
+static uint8_t _uartErrCount = 0;
+
+static UartSensorReply_st _uartSensorReply = { 0 };
+static portMUX_TYPE _uartReplyMux = portMUX_INITIALIZER_UNLOCKED;
+
+/* End of the last request, turnaround is measured from here to the reply */
+static int64_t _uartRxDoneUs = 0;
+
+static void LocalHandleIncommingData(const UartFrame_st *frame);
+
+static bool LocalIsValidBaudrate(uint32_t baud)
+{
+  switch (baud)
+  {
+    case 9600:
+    case 19200:
+    case 38400:
+    case 57600:
+    case 115200:
+    case 230400:
+    case 460800:
+    case 921600:
+      return true;
+
+    default: return false;
+  }
+}
+
+static void LocalSetBaudrate(uint32_t baud)
+{
+  uart_wait_tx_done(UART_PORT, pdMS_TO_TICKS(UART_FRAME_TIMEOUT));
+  if (uart_set_baudrate(UART_PORT, baud) == ESP_OK) {
+    uart_flush_input(UART_PORT);
+    _uartRx.Reset();
+    _uartBaudrate = baud;
+    _uartErrCount = 0;
+    _uartErrWindowStart = millis();
+    log_i("Baudrate: %u", baud);
+  } else {
+    log_e("Failed to set baudrate: %u", baud);
+  }
+}
+
+/* Receive errors at a negotiated rate may mean the line can't carry it, go back to the default rate */
+static void LocalCountRxError()
+{
+  if (_uartBaudrate == UART_DEFAULT_BAUDRATE) {
+    return;
+  }
+
+  if (millis() - _uartErrWindowStart > UART_BAUD_ERR_WINDOW) {
+    _uartErrWindowStart = millis();
+    _uartErrCount = 0;
+  }
+
+  if (++_uartErrCount >= UART_BAUD_ERR_LIMIT) {
+    _uartStats.baud_fallback++;
+    log_e("Too many errors at %u, falling back to %u", _uartBaudrate, UART_DEFAULT_BAUDRATE);
+    LocalSetBaudrate(UART_DEFAULT_BAUDRATE);
+    DB_SetUartBaudrate(UART_DEFAULT_BAUDRATE);
+    _uartBaudVerified = true;
   }
-  return crc;
 }
 
 static void uart_event_task(void *pvParameters)
 {
   uart_event_t event;
   uint8_t recv_data[UART_BUFF_SIZE];
-  uint8_t *pData = NULL;
-  uint16_t data_cnt = 0, data_len = 0;
-  unsigned long timeout = 0;
+
+  _uartRx.Attach(_uartFrame.data, sizeof(_uartFrame.data));
 
   while (1) {
-    if (xQueueReceive(*(QueueHandle_t*)pvParameters, (void *)&event, (_uartState == UART_STATE_IDLE)? portMAX_DELAY : pdMS_TO_TICKS(UART_FRAME_TIMEOUT))) {
+    if (xQueueReceive(*(QueueHandle_t*)pvParameters, (void *)&event, _uartRx.IsIdle()? portMAX_DELAY : pdMS_TO_TICKS(UART_FRAME_TIMEOUT))) {
       switch (event.type) {
         case UART_DATA: {
           int len = uart_read_bytes(UART_PORT, recv_data, event.size, portMAX_DELAY);
           for (int i = 0; i < len; i++)
           {
             log_d("%02X", recv_data[i]);
-            switch (_uartState)
+
+            switch (_uartRx.Feed(recv_data[i]))
             {
-              case UART_STATE_IDLE:
-                if (recv_data[i] == STX) {
-                  if (pData) {
-                    free(pData);
-                    pData = NULL;
-                  }
-                  _uartState = UART_STATE_LEN;
+              case RS485_RX_FRAME:
+              {
+                int64_t rx_done_us = esp_timer_get_time();
+                _uartStats.rx_frames++;
+                if ( ! _uartBaudVerified) {
+                  /* First good frame at a negotiated rate, keep it across reboots */
+                  _uartBaudVerified = true;
+                  DB_SetUartBaudrate(_uartBaudrate);
                 }
-                break;
-              case UART_STATE_LEN:
-                data_len = recv_data[i];
-                if (data_len > UART_PROTOCOL_CRC_LEN) {
-                  pData = (uint8_t *)malloc(data_len);
-                  if (pData) {
-                    data_cnt = 0;
-                    _uartState = UART_STATE_DATA;
-                  } else {
-                    log_e("Failed to allocate memory: %d (bytes)", data_len);
-                    _uartState = UART_STATE_IDLE;
-                  }
-                } else {
-                  log_e("Invalid data length: %d", data_len);
-                  _uartState = UART_STATE_IDLE;
+                _uartFrame.id = _uartRx.Address();
+                /* Other nodes' replies share the bus, only a request this node answers starts the turnaround clock */
+                if (_uartFrame.id == UART_PROTOCOL_BROADCAST || _uartFrame.id == DB_GetDeviceId()) {
+                  _uartRxDoneUs = rx_done_us;
                 }
+                _uartFrame.len = _uartRx.PayloadLen();
+                LocalHandleIncommingData(&_uartFrame);
+              }
                 break;
-              case UART_STATE_DATA:
-                pData[data_cnt++] = recv_data[i];
-                if (data_cnt >= data_len) {
-                  _uartState = UART_STATE_ETX;
-                }
+              case RS485_RX_ERR_LEN:
+                _uartStats.bad_len++;
+                log_e("Invalid data length");
+                LocalCountRxError();
                 break;
-              case UART_STATE_ETX:
-                if (recv_data[i] == ETX) {
-                  LocalHandleIncommingData(pData, data_len);
-                } else {
-                  log_e("Invalid ETX: 0x%X", recv_data[i]);
-                }
-
-                _uartState = UART_STATE_IDLE;
+              case RS485_RX_ERR_CRC:
+                _uartStats.bad_crc++;
+                log_e("Invalid CRC");
+                LocalCountRxError();
+                break;
+              case RS485_RX_ERR_ETX:
+                _uartStats.bad_etx++;
+                log_e("Invalid ETX: 0x%X", recv_data[i]);
+                LocalCountRxError();
                 break;
               default: break;
             }
-
-            timeout = millis();
           }
           break;
         }
+        case UART_FRAME_ERR:
+        case UART_PARITY_ERR:
+        case UART_BREAK:
+          _uartStats.line_err++;
+          LocalCountRxError();
+          break;
         default:
           break;
       }
     }
     else
     {
-      if (_uartState != UART_STATE_IDLE) {
+      if ( ! _uartRx.IsIdle()) {
+        _uartStats.timeout++;
         log_e("Timeout!");
-        _uartState = UART_STATE_IDLE;
+        _uartRx.Reset();
+        LocalCountRxError();
       }
     }
   }
@@ -131,54 +211,146 @@ static void uart_event_task(void *pvParameters)
 
 bool UART_SendBytes(uint8_t *data, uint16_t data_len)
 {
-  int sent_len = 0;
-  uint16_t packet_len = data_len + 5;
-  uint8_t *packet = (uint8_t *)malloc(packet_len);
-  if (packet) {
-    packet[0] = STX;
-    packet[1] = data_len + 2;  //ID and CRC16
-    // packet[2] = DEVICE_ID;
-    memcpy(&packet[2], data, data_len);
-    uint16_t crc = LocalCalculateCrc16(&packet[1], data_len + 1);
-    packet[packet_len - 3] = crc >> 8;
-    packet[packet_len - 2] = crc & 0xFF;
-    packet[packet_len - 1] = ETX;
-    // sent_len = uart_write_bytes(UART_PORT, packet, packet_len);
-    sent_len = Serial.write(packet, packet_len);
-
-    free(packet);
+  /* STX - LEN - (DATA) - CRC_H - CRC_L - ETX, no ID */
+  uint8_t packet[Rs485Frame<0>::MAX_FRAME];
+  size_t packet_len = Rs485Frame<0>::Encode(packet, sizeof(packet), 0, data, data_len);
+  if (packet_len == 0) {
+    log_e("Invalid data length: %d", data_len);
+    return false;
   }
 
+  int sent_len = Serial.write(packet, packet_len);
   return (sent_len == packet_len);
 }
 
-bool UART1_SendBytes(uint8_t *data, uint16_t data_len)
+static bool LocalSendFrame(const uint8_t *packet, size_t packet_len)
 {
-  int sent_len = 0;
-  uint16_t packet_len = data_len + 6; //STX - LEN - ID - (DATA) - CRC_H - CRC_L - ETX
-  uint8_t *packet = (uint8_t *)malloc(packet_len);
-  if (packet) {
-    packet[0] = STX;
-    packet[1] = data_len + 3;  //ID and CRC16
-    packet[2] = DB_GetDeviceId();
-    memcpy(&packet[3], data, data_len);
-    uint16_t crc = LocalCalculateCrc16(&packet[1], data_len + 2);
-    packet[packet_len - 3] = crc >> 8;
-    packet[packet_len - 2] = crc & 0xFF;
-    packet[packet_len - 1] = ETX;
-    sent_len = uart_write_bytes(UART_PORT, packet, packet_len);
-
-    free(packet);
+  uint32_t turnaround = (uint32_t)(esp_timer_get_time() - _uartRxDoneUs);
+  int sent_len = uart_write_bytes(UART_PORT, packet, packet_len);
+
+  _uartStats.turnaround_us = turnaround;
+  if (turnaround > _uartStats.turnaround_max_us) {
+    _uartStats.turnaround_max_us = turnaround;
+  }
+
+#if (RS485_DE != UART_PIN_NO_CHANGE)
+  bool collision = false;
+  if (uart_wait_tx_done(UART_PORT, pdMS_TO_TICKS(UART_FRAME_TIMEOUT)) == ESP_OK &&
+      uart_get_collision_flag(UART_PORT, &collision) == ESP_OK && collision) {
+    _uartStats.collisions++;
+    log_e("Collision on reply (%u)", _uartStats.collisions);
+    return false;
   }
+#endif
 
   return (sent_len == packet_len);
 }
 
-void LocalHandleIncommingData(uint8_t *data, uint16_t data_len)
+bool UART1_SendBytes(uint8_t *data, uint16_t data_len)
+{
+  uint8_t packet[UartCodec::MAX_FRAME];
+  size_t packet_len = UartCodec::Encode(packet, sizeof(packet), DB_GetDeviceId(), data, data_len);
+  if (packet_len == 0) {
+    log_e("Invalid data length: %d", data_len);
+    return false;
+  }
+
+  return LocalSendFrame(packet, packet_len);
+}
+
+void UART_UpdateSensorReply(float mA, float V, bool smoke, bool fire, ChargeState_e charge, uint8_t confidence)
+{
+  UartSensorReply_st reply = { .smoke = smoke, .fire = fire };
+  uint8_t payload[UART_SENSOR_REPLY_LEN];
+  uint8_t pos = 0;
+
+  memcpy(payload, (uint8_t *)&mA, sizeof(float)); pos += sizeof(float);
+  memcpy(&payload[pos], (uint8_t *)&V, sizeof(float)); pos += sizeof(float);
+  payload[pos] = smoke? 1 : 0; pos++;
+  payload[pos] = fire? 1 : 0; pos++;
+  payload[pos] = charge; pos++;
+  payload[pos] = confidence;
+  reply.len = UartCodec::Encode(reply.frame, sizeof(reply.frame), DB_GetDeviceId(), payload, sizeof(payload));
+
+  portENTER_CRITICAL(&_uartReplyMux);
+  memcpy(&_uartSensorReply, &reply, sizeof(UartSensorReply_st));
+  portEXIT_CRITICAL(&_uartReplyMux);
+}
+
+static void LocalSendSensorReply()
+{
+  UartSensorReply_st reply;
+  bool smoke_detected = SENSOR_SMOKE_Detected();
+  bool fire_detected = SENSOR_FIRE_Detected();
+
+  portENTER_CRITICAL(&_uartReplyMux);
+  memcpy(&reply, &_uartSensorReply, sizeof(UartSensorReply_st));
+  portEXIT_CRITICAL(&_uartReplyMux);
+
+  /* Alarms must not wait for the next sample */
+  if (reply.len == 0 || reply.smoke != smoke_detected || reply.fire != fire_detected) {
+    uint8_t confidence;
+    ChargeState_e charge = SENSOR_GetChargeState(&confidence);
+    UART_UpdateSensorReply(SENSOR_GetCurrent_mA(), SENSOR_GetVoltage(), smoke_detected, fire_detected, charge, confidence);
+
+    portENTER_CRITICAL(&_uartReplyMux);
+    memcpy(&reply, &_uartSensorReply, sizeof(UartSensorReply_st));
+    portEXIT_CRITICAL(&_uartReplyMux);
+  }
+
+  LocalSendFrame(reply.frame, reply.len);
+}
+
+/* One reply's air time at the current baud rate, 10 bits per byte, plus skew */
+static uint8_t LocalSlotTime(uint16_t reply_len)
+{
+  uint32_t bits = (UartCodec::OVERHEAD + reply_len) * 10;
+  uint32_t ms = (bits * 1000 + _uartBaudrate - 1) / _uartBaudrate + UART_REPLY_SLOT_GUARD;
+  return (uint8_t)min(ms, (uint32_t)UINT8_MAX);
+}
+
+/*
+ * Broadcast requests end with optional [FIRST_ID] [SLOT_TIME ms], the slot
+ * defaults to one reply_len reply at the current baud rate.
+ * Every node answers (id - FIRST_ID) slots after the end of the request so one
+ * request yields a collision free train of replies. Time spent handling the
+ * request counts against the slot, only the rest is waited.
+ */
+static bool LocalWaitReplySlot(const uint8_t *data, uint16_t data_len, uint16_t pos, uint16_t reply_len)
 {
-  if (data_len > 1) {
-    uint8_t id = data[0];
-    UartCmds_e cmd = (UartCmds_e)data[1];
+  int dev_id = DB_GetDeviceId();
+  uint8_t first_id = (data_len > pos)? data[pos] : UART_REPLY_FIRST_ID;
+  uint8_t slot_time = (data_len > pos + 1 && data[pos + 1] > 0)? data[pos + 1] : LocalSlotTime(reply_len);
+
+  if (dev_id < first_id) {
+    return false;
+  }
+
+  int64_t slot_us = _uartRxDoneUs + (int64_t)(dev_id - first_id) * slot_time * 1000;
+  int64_t remaining;
+  while ((remaining = slot_us - esp_timer_get_time()) > 0) {
+    /* Sleep whole ticks while it can't overshoot, spin the last one */
+    TickType_t ticks = remaining / (portTICK_PERIOD_MS * 1000);
+    if (ticks > 1) {
+      vTaskDelay(ticks - 1);
+    } else {
+      delayMicroseconds(remaining);
+    }
+  }
+
+  /* The slot wait is on purpose, keep it out of the turnaround stat */
+  _uartRxDoneUs = esp_timer_get_time();
+  return true;
+}
+
+void LocalHandleIncommingData(const UartFrame_st *frame)
+{
+  uint8_t id = frame->id;
+  const uint8_t *data = frame->data;
+  uint16_t data_len = frame->len;
+
+  if (data_len > 0) {
+    UartCmds_e cmd = (UartCmds_e)data[0];
 
     if (id == UART_PROTOCOL_BROADCAST || id == DB_GetDeviceId())
     {
@@ -187,23 +359,148 @@ void LocalHandleIncommingData(uint8_t *data, uint16_t data_len)
         case UART_CMD_GET_CURRENT_mA:
         {
           log_i("Get Current mA");
-          float current_mA = SENSOR_GetCurrent_mA();
-          float busVoltage = SENSOR_GetVoltage();
-          bool smoke_detected = SENSOR_SMOKE_Detected();
-          bool fire_detected = SENSOR_FIRE_Detected();
-          int buffer_size = sizeof(float) * 2 + 2;  //mA(float) + vol(float) + smoke(bool) + fire(bool)
-          uint8_t buffer[buffer_size] = { 0 };
-          uint8_t pos = 0;
-          memcpy(buffer, (uint8_t *)&current_mA, sizeof(float)); pos += sizeof(float);
-          memcpy(&buffer[pos], (uint8_t *)&busVoltage, sizeof(float)); pos += sizeof(float);
-          buffer[pos] = smoke_detected? 1 : 0; pos++;
-          buffer[pos] = fire_detected? 1 : 0;
-          UART1_SendBytes(buffer, buffer_size);
+          if (id == UART_PROTOCOL_BROADCAST && ! LocalWaitReplySlot(data, data_len, 1, UART_SENSOR_REPLY_LEN)) {
+            break;
+          }
+
+          LocalSendSensorReply();
         }
           break;
 
         case UART_CMD_SET_THRESHOLD:
-          log_i("Set threshold");
+        {
+          /* [CMD] [FULL mA u16 LE] [NOT CHARGED mA u16 LE] [FIRST_ID] [SLOT_TIME ms], ack [CMD] [OK] */
+          /* Shorthand for a REGISTERS write of FULL_mA and NOTCHARGED_mA */
+          uint16_t values[2] = { 0, 0 };
+          bool valid = false;
+
+          if (data_len >= 1 + sizeof(values)) {
+            memcpy(values, &data[1], sizeof(values));
+            valid = SENSOR_WriteRegs(SENSOR_REG_FULL_mA, 2, values) == SENSOR_REG_OK;
+          }
+          log_i("Set threshold: full %u, not charged %u (%s)", values[0], values[1], valid? "valid" : "invalid");
+
+          if (id != UART_PROTOCOL_BROADCAST || LocalWaitReplySlot(data, data_len, 1 + sizeof(uint16_t) * 2, UART_ACK_REPLY_LEN)) {
+            uint8_t ack[UART_ACK_REPLY_LEN] = { UART_CMD_SET_THRESHOLD, (uint8_t)(valid? 1 : 0) };
+            UART1_SendBytes(ack, sizeof(ack));
+          }
+          if (valid) {
+            SENSOR_SaveRegs();
+          }
+        }
+          break;
+
+        case UART_CMD_SET_BAUDRATE:
+        {
+          /* [CMD] [BAUD u32 LE] [FIRST_ID] [SLOT_TIME ms], ack at the old rate then switch */
+          unsigned long request_time = millis();
+          uint32_t baud = 0;
+          bool reply = true;
+
+          if (data_len >= 1 + sizeof(uint32_t)) {
+            memcpy(&baud, &data[1], sizeof(uint32_t));
+          }
+          bool valid = LocalIsValidBaudrate(baud);
+          log_i("Set baudrate: %u (%s)", baud, valid? "valid" : "invalid");
+
+          if (id == UART_PROTOCOL_BROADCAST) {
+            reply = LocalWaitReplySlot(data, data_len, 1 + sizeof(uint32_t), UART_ACK_REPLY_LEN);
+          }
+
+          if (reply) {
+            uint8_t ack[UART_ACK_REPLY_LEN] = { UART_CMD_SET_BAUDRATE, (uint8_t)(valid? 1 : 0) };
+            UART1_SendBytes(ack, sizeof(ack));
+          }
+
+          if (valid && baud != _uartBaudrate) {
+            unsigned long elapsed = millis() - request_time;
+            if (elapsed < UART_BAUD_SWITCH_DELAY) {
+              vTaskDelay(pdMS_TO_TICKS(UART_BAUD_SWITCH_DELAY - elapsed));
+            }
+            LocalSetBaudrate(baud);
+            _uartBaudVerified = false;
+          }
+        }
+          break;
+
+        case UART_CMD_GET_ALARM:
+        {
+          /*
+           * Alarm scan, the host's reserved slot in its bus schedule: [CMD] [FIRST_ID] [SLOT_TIME ms].
+           * Broadcast scans are only answered while a change is unacknowledged, so an idle bus stays quiet.
+           * Reply: [CMD] [ALARMS] [LATCHED] [SEQ] [AGE ms u16 LE]
+           */
+          SensorAlarmEvent_st event;
+          SENSOR_GetAlarmEvent(&event);
+          if (id == UART_PROTOCOL_BROADCAST && (event.seq == event.acked || ! LocalWaitReplySlot(data, data_len, 1, UART_ALARM_REPLY_LEN))) {
+            break;
+          }
+
+          uint16_t age = (uint16_t)min(millis() - event.ts_ms, (unsigned long)UINT16_MAX);
+          uint8_t reply[UART_ALARM_REPLY_LEN] = { UART_CMD_GET_ALARM, event.alarms, event.latched, event.seq, (uint8_t)age, (uint8_t)(age >> 8) };
+          UART1_SendBytes(reply, sizeof(reply));
+        }
+          break;
+
+        case UART_CMD_ACK_ALARM:
+          /* [CMD] [SEQ], addressed only, no reply */
+          if (id != UART_PROTOCOL_BROADCAST && data_len >= 2) {
+            SENSOR_AckAlarm(data[1]);
+            log_i("Alarm %d acknowledged", data[1]);
+          }
+          break;
+
+        case UART_CMD_REGISTERS:
+        {
+          /*
+           * [CMD] [TYPE] [START] [COUNT] [VALUES u16 LE, writes only] [FIRST_ID] [SLOT_TIME ms]
+           * Reply: [CMD] [TYPE] [START] [COUNT] [STATUS] [VALUES u16 LE, reads only]
+           * One broadcast write reconfigures every node, it is only acked when the slot params are given.
+           */
+          uint16_t values[UART_REG_COUNT_MAX];
+          SensorRegStatus_e status = SENSOR_REG_ERR_ADDRESS;
+
+          if (data_len < 4 || data[3] > UART_REG_COUNT_MAX) {
+            break;
+          }
+
+          UartTypes_e type = (UartTypes_e)data[1];
+          uint8_t start = data[2];
+          uint8_t count = data[3];
+          uint16_t pos = 4;
+
+          if (type == UART_TYPE_READ) {
+            status = SENSOR_ReadRegs(start, count, values);
+          } else if (type == UART_TYPE_WRITE) {
+            pos += count * sizeof(uint16_t);
+            if (data_len < pos) {
+              break;
+            }
+            memcpy(values, &data[4], count * sizeof(uint16_t));
+            status = SENSOR_WriteRegs(start, count, values);
+          } else {
+            break;
+          }
+          log_i("Registers %s %u+%u: %d", (type == UART_TYPE_READ)? "read" : "write", start, count, status);
+
+          bool reply = (id != UART_PROTOCOL_BROADCAST) ||
+                       ((type == UART_TYPE_READ || data_len > pos) &&
+                        LocalWaitReplySlot(data, data_len, pos, UART_REG_REPLY_LEN + ((type == UART_TYPE_READ)? count * sizeof(uint16_t) : 0)));
+          if (reply) {
+            uint8_t buf[UART_REG_REPLY_LEN + sizeof(values)] = { UART_CMD_REGISTERS, (uint8_t)type, start, count, (uint8_t)status };
+            uint16_t reply_len = UART_REG_REPLY_LEN;
+            if (type == UART_TYPE_READ && status == SENSOR_REG_OK) {
+              memcpy(&buf[reply_len], values, count * sizeof(uint16_t));
+              reply_len += count * sizeof(uint16_t);
+            }
+            UART1_SendBytes(buf, reply_len);
+          }
+
+          /* Persisted after the reply, the NVS commit must not eat into the slot */
+          if (type == UART_TYPE_WRITE && status == SENSOR_REG_OK) {
+            SENSOR_SaveRegs();
+          }
+        }
           break;
 
         default: break;
@@ -212,12 +509,24 @@ void LocalHandleIncommingData(uint8_t *data, uint16_t data_len)
   }
 }
 
+void UART_GetStats(UartStats_st *stats)
+{
+  if (stats) {
+    memcpy(stats, &_uartStats, sizeof(UartStats_st));
+  }
+}
+
 void UART_Init()
 {
   _uartQueue = xQueueCreate(1024, sizeof(char));
 
+  _uartBaudrate = DB_GetUartBaudrate(UART_DEFAULT_BAUDRATE);
+  if ( ! LocalIsValidBaudrate(_uartBaudrate)) {
+    _uartBaudrate = UART_DEFAULT_BAUDRATE;
+  }
+
   const uart_config_t uart_config = {
-      .baud_rate = 115200,
+      .baud_rate = (int)_uartBaudrate,
       .data_bits = UART_DATA_8_BITS,
       .parity    = UART_PARITY_DISABLE,
       .stop_bits = UART_STOP_BITS_1,
@@ -227,7 +536,12 @@ void UART_Init()
 
   ESP_ERROR_CHECK(uart_driver_install(UART_PORT, UART_BUFF_SIZE, UART_BUFF_SIZE, 20, &_uartQueue, ESP_INTR_FLAG_SHARED));
   ESP_ERROR_CHECK(uart_param_config(UART_PORT, &uart_config));
-  ESP_ERROR_CHECK(uart_set_pin(UART_PORT, RS485_RX, RS485_TX, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+  ESP_ERROR_CHECK(uart_set_pin(UART_PORT, RS485_RX, RS485_TX, RS485_DE, UART_PIN_NO_CHANGE));
+#if (RS485_DE != UART_PIN_NO_CHANGE)
+  /* Driver enable follows RTS in hardware, no guard time needed around replies */
+  ESP_ERROR_CHECK(uart_set_mode(UART_PORT, UART_MODE_RS485_HALF_DUPLEX));
+#endif
+  ESP_ERROR_CHECK(uart_set_rx_timeout(UART_PORT, UART_RX_TOUT));
 
   xTaskCreate(uart_event_task, "uart_event_task", 4096, &_uartQueue, 12, NULL);
 }
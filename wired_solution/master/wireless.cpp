@@ -1,7 +1,16 @@
 #include "common.h"
 #include <esp_now.h>
 
-#define TCP_QUEUE_SIZE                        10
+#define TCP_RX_RING_SIZE                      8
+#define TCP_RX_CHUNK_SIZE                     256
+#define TCP_LINE_MAX                          256     //Longest command line, longer ones are discarded
+
+#define TCP_CLIENT_MAX                        3       //Server, dashboard, logger
+#define TCP_TX_RING_SIZE                      8192    //Per client, a couple of full keyframes
+#define TCP_EVICT_MS                          10000   //A client that can't take frames this long is dropped
+
+#define ESPNOW_RX_RING_SIZE                   16
+#define ESPNOW_RX_DATA_MAX                    32      //Our messages are a dozen bytes, anything longer is not ours
 
 uint8_t _broadcastAddress[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 
@@ -10,57 +19,162 @@ static AsyncUDP _udpServer;
 static AsyncServer _tcpServer(CONFIG_TCP_SERVER_PORT);
 const char *udp_broadcast_msg = "Where are you, eLocker?";
 const char *udp_response_msg = "Here I am, eLocker";
-static AsyncClient *_tcpClient = nullptr;
 static WebServer _apServer(80);
 static TaskHandle_t _tcpTaskHdl = NULL;
-static QueueHandle_t _tcpQ = NULL;
+
+typedef struct {
+  int8_t client;        //Slot in _tcpClients the data came from
+  uint16_t len;         //0 marks a new connection on the slot
+  uint32_t rx_us;
+  uint8_t data[TCP_RX_CHUNK_SIZE];
+} TcpRxChunk_st;
+
+/* Tail of a command line split across chunks, owned by tcp_handler_task */
+typedef struct {
+  uint16_t len;
+  bool overflow;
+  char buf[TCP_LINE_MAX];
+} TcpLine_st;
+
+typedef bool (*TcpCmdHandler_t)(int8_t client, JsonDocument &doc);
+
+typedef struct {
+  const char *name;
+  TcpCmdHandler_t handler;
+  uint32_t count;
+  uint32_t max_us;
+} TcpCmd_st;
+
+/* Outbound bytes wait here until the client's TCP window opens, whole frames only */
+typedef struct {
+  AsyncClient *client;
+  size_t head;
+  size_t tail;
+  size_t used;
+  uint32_t full_since;
+  uint32_t dropped;
+  bool closing;         //Being evicted, TCP_Send owns the client until it is closed and deleted
+  uint8_t tx[TCP_TX_RING_SIZE];
+} TcpClient_st;
+
+static TcpClient_st _tcpClients[TCP_CLIENT_MAX];
+static SemaphoreHandle_t _tcpClientsMutex = NULL;
+
+static SpscRing<TcpRxChunk_st, TCP_RX_RING_SIZE> _tcpRxRing;   //AsyncTCP -> tcp_handler_task
 #endif
 
 #if defined(DEVICE_TYPE_SLAVE)
 static bool espnowDiscovered_ = false;
+static uint8_t _replyChannel = 0;                 //espnow_rx_task -> discovery task, 0 when none is pending
+static SemaphoreHandle_t _replySignal = NULL;     //Given with every reply, outlives the discovery task
 static bool LocalModifyBroadcastPeer(uint8_t new_channel);
 #endif
 
-static const char *MSG_DISCOVER = "DISCOVER";
+typedef struct {
+  uint8_t src[ESP_NOW_ETH_ALEN];
+  uint8_t len;
+  uint8_t data[ESPNOW_RX_DATA_MAX];
+} EspNowRxFrame_st;
+
+static SpscRing<EspNowRxFrame_st, ESPNOW_RX_RING_SIZE> _espnowRxRing;  //Wi-Fi task -> espnow_rx_task
+static TaskHandle_t _espnowRxTask = NULL;
+static volatile uint32_t _espnowRxOversize = 0;
+
+static const char *MSG_DISCOVER = ESPNOW_MSG_DISCOVER;
 esp_now_peer_info_t broadcastPeer_ = {0};
 
+/* Runs on the Wi-Fi task: copy the frame out for espnow_rx_task and leave */
 void onBroadcastReceive(const esp_now_recv_info_t *info, const uint8_t *data, int len)
 {
-  log_i("Received a message from " MACSTR " - len: %d - %.*s", MAC2STR(info->src_addr), len, len, data);
+  if (len <= 0 || len > ESPNOW_RX_DATA_MAX) {
+    _espnowRxOversize++;
+    return;
+  }
+
+  EspNowRxFrame_st *frame = _espnowRxRing.PushBegin();
+  if (frame == NULL) {
+    return;
+  }
+
+  memcpy(frame->src, info->src_addr, ESP_NOW_ETH_ALEN);
+  frame->len = len;
+  memcpy(frame->data, data, len);
+  _espnowRxRing.PushCommit();
+
+  if (_espnowRxTask) {
+    xTaskNotifyGive(_espnowRxTask);
+  }
+}
+
+/* Returns true for a master side DISCOVER request, answered once per batch */
+static bool LocalHandleEspnowFrame(const EspNowRxFrame_st *frame)
+{
+  const uint8_t *data = frame->data;
+  int len = frame->len;
+
+  log_d("Received a message from " MACSTR " - len: %d", MAC2STR(frame->src), len);
+  if (data[0] == ESPNOW_MSG_TELEMETRY) {
 #if defined(DEVICE_TYPE_MASTER)
-  if (memcmp(MSG_DISCOVER, data, len) == 0) {
-    WIRELESS_Broadcast(String(MSG_DISCOVER) + "," + String(broadcastPeer_.channel));
-  } else {
     DEVICES_UpdateInfo(data, len);
+#endif
+    /* Slaves hear each other's broadcasts, nothing to do */
+    return false;
+  }
+
+#if defined(DEVICE_TYPE_MASTER)
+  if (len == (int)strlen(MSG_DISCOVER) && memcmp(MSG_DISCOVER, data, len) == 0) {
+    return true;
   }
+  log_e("Unhandled message, len: %d", len);
 #endif
 
 #if defined(DEVICE_TYPE_SLAVE)
-  if (memcmp(MSG_DISCOVER, data, strlen(MSG_DISCOVER)) == 0) {
-    espnowDiscovered_ = true;
+  uint8_t channel;
+  if (ESPNOW_ParseDiscoverReply(data, len, &channel)) {
+    /* Only the discovery task moves the radio, it gets the reply and decides */
+    log_d("DISCOVER reply, channel %d", channel);
+    __atomic_store_n(&_replyChannel, channel, __ATOMIC_RELEASE);
+    xSemaphoreGive(_replySignal);
+  } else if (len == (int)strlen(MSG_DISCOVER) && memcmp(MSG_DISCOVER, data, len) == 0) {
+    /* Another slave probing */
+  } else {
+    log_e("Unhandled message: %.*s", len, data);
+  }
+#endif
 
-    String msg = String(data, len);
-    uint8_t discovered_channel = 0;
-    size_t commaIndex = msg.indexOf(',');
+  return false;
+}
 
-    if (commaIndex != -1) {
-      String numStr = msg.substring(commaIndex + 1);
-      int value = numStr.toInt();
-      discovered_channel = value;
-    } else {
-      discovered_channel = broadcastPeer_.channel;
+static void espnow_rx_task(void *param)
+{
+  uint32_t lastDropped = 0, lastOversize = 0;
+
+  while (1)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    EspNowRxFrame_st *frame;
+    bool discover = false;
+    uint8_t batch = 0;
+    while ((frame = _espnowRxRing.PopBegin()) != NULL) {
+      discover |= LocalHandleEspnowFrame(frame);
+      _espnowRxRing.PopCommit();
+      batch++;
     }
 
-    log_i("Discovered Channel: %d", discovered_channel);
-    DB_SetEspNowChannel(discovered_channel);
+    /* Slaves discovering in the same burst all get one answer */
+    if (discover) {
+      WIRELESS_Broadcast(String(MSG_DISCOVER) + "," + String(broadcastPeer_.channel));
+    }
+    log_d("ESP-NOW batch of %d", batch);
 
-    if (discovered_channel != broadcastPeer_.channel) {
-      LocalModifyBroadcastPeer(discovered_channel);
+    if (_espnowRxRing.Dropped() != lastDropped || _espnowRxOversize != lastOversize) {
+      log_e("ESP-NOW rx dropped %u, oversize %u (high water %u/%u)", _espnowRxRing.Dropped() - lastDropped,
+            _espnowRxOversize - lastOversize, _espnowRxRing.HighWater(), _espnowRxRing.Capacity());
+      lastDropped = _espnowRxRing.Dropped();
+      lastOversize = _espnowRxOversize;
     }
-  } else {
-    log_e("Unhandled message: %.*s", len, data);
   }
-#endif
 }
 
 void OnDataSent(const esp_now_send_info_t *tx_info, esp_now_send_status_t status)
@@ -137,30 +251,47 @@ bool LocalRegisterBroadcastPeer(const uint8_t *mac_addr, uint8_t channel)
 
 #if defined(DEVICE_TYPE_SLAVE)
 bool WIRELESS_IsDiscovered() {
-  return espnowDiscovered_;
+  return __atomic_load_n(&espnowDiscovered_, __ATOMIC_ACQUIRE);
 }
 
-void WIRELESS_ChannelDiscoverLoop(byte channel_start)
+/* The radio as ESPNOW_DiscoverChannel() drives it, from the discovery task only */
+class DiscoveryRadio
 {
-  byte chn = channel_start;
+public:
+  void SetChannel(uint8_t chn)
+  {
+    WiFi.setChannel(chn);
+    LocalModifyBroadcastPeer(chn);
+  }
 
-  do {
-    log_i("Discovering on channel %d", chn);
-    {
-      WiFi.setChannel(chn);
-      LocalModifyBroadcastPeer(chn);
-      WIRELESS_Broadcast((const uint8_t *)MSG_DISCOVER, strlen(MSG_DISCOVER));
-      delay(2000);
-      if (espnowDiscovered_) {
-        break;
-      }
-    }
+  void SendProbe()
+  {
+    WIRELESS_Broadcast((const uint8_t *)MSG_DISCOVER, strlen(MSG_DISCOVER));
+  }
 
-    chn++;
-    if (chn > 11) {
-      chn = 1;
+  uint8_t WaitReply(uint16_t ms)
+  {
+    if (xSemaphoreTake(_replySignal, pdMS_TO_TICKS(ms)) != pdTRUE) {
+      return 0;
     }
-  } while (1);
+    return __atomic_exchange_n(&_replyChannel, 0, __ATOMIC_ACQ_REL);
+  }
+};
+
+void WIRELESS_ChannelDiscoverLoop(byte channel_start)
+{
+  DiscoveryRadio radio;
+  uint16_t visits;
+  uint32_t start = millis();
+
+  /* Nothing from an earlier run counts */
+  __atomic_store_n(&_replyChannel, 0, __ATOMIC_RELEASE);
+  xSemaphoreTake(_replySignal, 0);
+
+  uint8_t channel = ESPNOW_DiscoverChannel(radio, channel_start, &visits);
+  DB_SetEspNowChannel(channel);
+  __atomic_store_n(&espnowDiscovered_, true, __ATOMIC_RELEASE);
+  log_i("Discovered channel %d in %u ms, %d channel visits", channel, millis() - start, visits);
 }
 
 void espnow_channel_discovery(void *param)
@@ -207,12 +338,20 @@ void WIRELESS_Init()
   log_i("WiFi Started! Parameters:");
   log_i("  MAC Address: " MACSTR " ", MAC2STR(WiFi.macAddress()));
   log_i("  ESPNOW Channel: %d", broadcastPeer_.channel);
+
+  if (_replySignal == NULL) {
+    _replySignal = xSemaphoreCreateBinary();
+  }
 #endif
 
 #if defined(DEVICE_TYPE_MASTER)
   broadcastPeer_.channel = WiFi.channel();
 #endif
 
+  if (_espnowRxTask == NULL) {
+    xTaskCreate(espnow_rx_task, "espnow_rx_task", 4096, NULL, 2, &_espnowRxTask);
+  }
+
   if (esp_now_init() != ESP_OK) {
     log_e("Error initializing ESP-NOW");
     while(1) { delay(500); }
@@ -256,28 +395,76 @@ void WIRELESS_Task() {}
 #if defined(DEVICE_TYPE_MASTER)
 static void tcp_handler_task(void *param);
 
-void LocalTcpSend(uint8_t cmd, uint8_t *data, uint16_t len, bool copy = true)
+/* Runs on the AsyncTCP task: copy into the ring and leave */
+static void LocalTcpRxPush(int8_t slot, const uint8_t *data, size_t len)
 {
-  if (_tcpQ)
-  {
-    QueueMsg_st msg = { cmd, data, len };
-    if (copy && len) {
-      msg.data = (uint8_t *)malloc(len);
-      if (msg.data) {
-        memcpy(msg.data, data, len);
-      }
+  while (len) {
+    TcpRxChunk_st *chunk = _tcpRxRing.PushBegin();
+    if (chunk == NULL) {
+      break;
     }
 
-    if (xQueueSend(_tcpQ, &msg, 0) != pdTRUE) {
-      log_e("Send queue failed!");
-      if (copy && len && msg.data) {
-        free(msg.data);
-        msg.data = NULL;
-      }
+    chunk->client = slot;
+    chunk->rx_us = micros();
+    chunk->len = min(len, (size_t)TCP_RX_CHUNK_SIZE);
+    memcpy(chunk->data, data, chunk->len);
+    _tcpRxRing.PushCommit();
+    data += chunk->len;
+    len -= chunk->len;
+  }
+
+  if (_tcpTaskHdl) {
+    xTaskNotifyGive(_tcpTaskHdl);
+  }
+}
+
+/* Callers hold _tcpClientsMutex */
+static void LocalClientDrain(TcpClient_st *c)
+{
+  while (c->client && ! c->closing && c->used) {
+    size_t chunk = min(min(c->used, TCP_TX_RING_SIZE - c->tail), c->client->space());
+    if (chunk == 0) {
+      break;
+    }
+
+    size_t added = c->client->add((const char *)&c->tx[c->tail], chunk, ASYNC_WRITE_FLAG_COPY);
+    if (added == 0) {
+      break;
     }
+    c->tail = (c->tail + added) % TCP_TX_RING_SIZE;
+    c->used -= added;
+  }
+
+  if (c->client && ! c->closing) {
+    c->client->send();
   }
 }
 
+/* Returns false when the frame doesn't fit, the client only ever sees whole frames */
+static bool LocalClientEnqueue(TcpClient_st *c, const uint8_t *data, size_t len)
+{
+  if (TCP_TX_RING_SIZE - c->used < len) {
+    return false;
+  }
+
+  size_t first = min(len, TCP_TX_RING_SIZE - c->head);
+  memcpy(&c->tx[c->head], data, first);
+  memcpy(&c->tx[0], data + first, len - first);
+  c->head = (c->head + len) % TCP_TX_RING_SIZE;
+  c->used += len;
+  return true;
+}
+
+static int8_t LocalClientSlot(AsyncClient *client)
+{
+  for (int8_t i = 0; i < TCP_CLIENT_MAX; i++) {
+    if (_tcpClients[i].client == client) {
+      return i;
+    }
+  }
+  return -1;
+}
+
 void SERVER_Init()
 {
   /* UDP Server */
@@ -295,28 +482,73 @@ void SERVER_Init()
   log_i("UDP Server listening on port %d", CONFIG_UDP_SERVER_PORT);
 
   /* TCP Server */
+  if (_tcpClientsMutex == NULL) {
+    _tcpClientsMutex = xSemaphoreCreateMutex();
+  }
+
   _tcpServer.onClient([] (void *arg, AsyncClient *client) {
-    log_i("New client connected! IP: "MACSTR" ", MAC2STR(client->remoteIP()));
-    _tcpClient = client;
+    xSemaphoreTake(_tcpClientsMutex, portMAX_DELAY);
+    int8_t slot = LocalClientSlot(NULL);
+    if (slot >= 0) {
+      TcpClient_st *c = &_tcpClients[slot];
+      c->client = client;
+      c->head = c->tail = c->used = 0;
+      c->full_since = 0;
+      c->dropped = 0;
+      c->closing = false;
+    }
+    xSemaphoreGive(_tcpClientsMutex);
 
-    client->onDisconnect([](void *arg, AsyncClient *client) {
-      log_i("** client has been disconnected: %" PRIu16 "", client->localPort());
-      _tcpClient = nullptr;
+    if (slot < 0) {
+      log_e("Client table full, rejecting %s", client->remoteIP().toString().c_str());
       client->close(true);
       delete client;
+      return;
+    }
+
+    log_i("New client connected! IP: %s, slot %d", client->remoteIP().toString().c_str(), slot);
+
+    /* Tells tcp_handler_task to forget a half line left by the slot's previous client */
+    TcpRxChunk_st *chunk = _tcpRxRing.PushBegin();
+    if (chunk) {
+      chunk->client = slot;
+      chunk->len = 0;
+      _tcpRxRing.PushCommit();
+    }
+    DEVICES_RequestKeyframe();
+
+    client->onDisconnect([](void *arg, AsyncClient *client) {
+      log_i("** client has been disconnected: %" PRIu16 "", client->localPort());
+      xSemaphoreTake(_tcpClientsMutex, portMAX_DELAY);
+      int8_t slot = LocalClientSlot(client);
+      bool evicting = (slot >= 0) && _tcpClients[slot].closing;
+      if (slot >= 0 && ! evicting) {
+        _tcpClients[slot].client = nullptr;
+      }
+      xSemaphoreGive(_tcpClientsMutex);
+
+      /* An evicted client is deleted by TCP_Send once its close() returns */
+      if ( ! evicting) {
+        client->close(true);
+        delete client;
+      }
+    });
+
+    client->onAck([](void *arg, AsyncClient *client, size_t len, uint32_t time) {
+      xSemaphoreTake(_tcpClientsMutex, portMAX_DELAY);
+      int8_t slot = LocalClientSlot(client);
+      if (slot >= 0) {
+        LocalClientDrain(&_tcpClients[slot]);
+      }
+      xSemaphoreGive(_tcpClientsMutex);
     });
 
     client->onData([](void *arg, AsyncClient *client, void *data, size_t len) {
       log_d("** data received by client: %" PRIu16 ": len=%u", client->localPort(), len);
-      log_d("%*s", len, data);
-      // TODO: Handler
-    });
+      LocalTcpRxPush((int8_t)(intptr_t)arg, (const uint8_t *)data, len);
+    }, (void *)(intptr_t)slot);
   }, NULL);
 
-  if (_tcpQ == NULL) {
-    _tcpQ = xQueueCreate(TCP_QUEUE_SIZE, sizeof(QueueMsg_st));
-  }
-
   if (_tcpTaskHdl == NULL) {
     xTaskCreate(tcp_handler_task, "tcp_handler_task", 8192, NULL, 1, &_tcpTaskHdl);
   }
@@ -326,57 +558,231 @@ void SERVER_Init()
 
 void SERVER_Send(String &msg)
 {
-  if (_tcpClient) {
-    if ( ! _tcpClient->write(msg.c_str())) {
-      log_e("TCP Write failed!");
-    } else {
-      log_i("Sent: %s", msg.c_str());
+  TCP_Send((uint8_t *)msg.c_str(), msg.length());
+}
+
+void TCP_Send(uint8_t *data, size_t len, int8_t client)
+{
+  AsyncClient *evict[TCP_CLIENT_MAX] = { NULL };
+
+  if (_tcpClientsMutex == NULL) {
+    return;
+  }
+
+  xSemaphoreTake(_tcpClientsMutex, portMAX_DELAY);
+  for (int8_t i = 0; i < TCP_CLIENT_MAX; i++) {
+    TcpClient_st *c = &_tcpClients[i];
+    if (c->client == NULL || c->closing || (client != TCP_CLIENT_ALL && client != i)) {
+      continue;
+    }
+
+    if (LocalClientEnqueue(c, data, len)) {
+      c->full_since = 0;
+      LocalClientDrain(c);
+      continue;
+    }
+
+    /* Slow consumer: drop the frame, and the client if it stays stuck */
+    c->dropped++;
+    if (c->full_since == 0) {
+      c->full_since = millis();
+    } else if (millis() - c->full_since > TCP_EVICT_MS) {
+      log_e("Evicting slow client %d, %u frames dropped", i, c->dropped);
+      evict[i] = c->client;
+      c->closing = true;
+    }
+  }
+  xSemaphoreGive(_tcpClientsMutex);
+
+  /*
+   * The slot holds on to the client until here so onDisconnect can't delete it first.
+   * Closing calls onDisconnect, which takes the mutex.
+   */
+  for (int8_t i = 0; i < TCP_CLIENT_MAX; i++) {
+    if (evict[i]) {
+      evict[i]->close(true);
+
+      xSemaphoreTake(_tcpClientsMutex, portMAX_DELAY);
+      _tcpClients[i].client = NULL;
+      _tcpClients[i].closing = false;
+      xSemaphoreGive(_tcpClientsMutex);
+      delete evict[i];
     }
   }
 }
 
-void TCP_Send(uint8_t *data, size_t len)
+/* A missing key keeps the register, anything that is not a u16 is refused before it gets truncated */
+static bool LocalJsonReg(JsonDocument &doc, const char *key, uint16_t *value)
 {
-  if (_tcpClient) {
-    if ( ! _tcpClient->write((const char *)data, len)) {
-      log_e("TCP Write failed!");
-    } else {
-      log_d("Sent: %s", msg.c_str());
+  JsonVariant v = doc[key];
+  if (v.isNull()) {
+    return true;
+  }
+  if ( ! v.is<int32_t>() || v.as<int32_t>() < 0 || UINT16_MAX < v.as<int32_t>()) {
+    return false;
+  }
+  *value = v.as<int32_t>();
+  return true;
+}
+
+/* Same checks, lock and single NVS commit as a REGISTERS write over RS485 */
+static bool LocalCmdWriteRegs(JsonDocument &doc, uint8_t start, const char *key0, const char *key1)
+{
+  uint16_t values[2];
+  SENSOR_ReadRegs(start, 2, values);
+  if ( ! LocalJsonReg(doc, key0, &values[0]) || ! LocalJsonReg(doc, key1, &values[1])) {
+    return false;
+  }
+  if (SENSOR_WriteRegs(start, 2, values) != SENSOR_REG_OK) {
+    return false;
+  }
+  SENSOR_SaveRegs();
+  return true;
+}
+
+static bool LocalCmdThreshold(int8_t client, JsonDocument &doc)
+{
+  /* {"cmd":"threshold","full":300,"notcharged":100}, mA */
+  return LocalCmdWriteRegs(doc, SENSOR_REG_FULL_mA, "full", "notcharged");
+}
+
+static bool LocalCmdPeriod(int8_t client, JsonDocument &doc)
+{
+  /* {"cmd":"period","hz":100,"ms":2000}, INA219 sample rate and publish period, either may be left out */
+  return LocalCmdWriteRegs(doc, SENSOR_REG_SAMPLE_HZ, "hz", "ms");
+}
+
+static bool LocalCmdHistory(int8_t client, JsonDocument &doc)
+{
+  /* {"cmd":"history","id":5,"tier":0,"from":0,"to":4294967295}, seconds since boot */
+  return HISTORY_SendRange(doc["id"] | 0, (HistoryTier_e)(doc["tier"] | 0), doc["from"] | 0UL, doc["to"] | UINT32_MAX, client);
+}
+
+static bool LocalCmdSnapshot(int8_t client, JsonDocument &doc)
+{
+  /* {"cmd":"snapshot"}, the next publish is a keyframe */
+  DEVICES_RequestKeyframe();
+  return true;
+}
+
+static TcpCmd_st _tcpCmds[] = {
+  { "threshold",  LocalCmdThreshold },
+  { "period",     LocalCmdPeriod },
+  { "history",    LocalCmdHistory },
+  { "snapshot",   LocalCmdSnapshot },
+};
+
+/* Replies are JSON lines, the server tells them from snapshot frames by the leading '{' */
+static void LocalSendTcpAck(int8_t client, const char *cmd, bool ok, uint32_t us)
+{
+  char ack[96];
+  int len = snprintf(ack, sizeof(ack), "{\"ack\":\"%s\",\"ok\":%s,\"us\":%u}\n", cmd, ok? "true" : "false", us);
+  if (0 < len && len < (int)sizeof(ack)) {
+    TCP_Send((uint8_t *)ack, len, client);
+  }
+}
+
+static void LocalDispatchLine(int8_t client, const char *line, size_t len, uint32_t rx_us)
+{
+  if (len && line[len - 1] == '\r') {
+    len--;
+  }
+  if (len == 0) {
+    return;
+  }
+
+  JsonDocument doc;
+  if (deserializeJson(doc, line, len) != DeserializationError::Ok) {
+    log_e("Bad command from client %d: %.*s", client, (int)len, line);
+    LocalSendTcpAck(client, "", false, micros() - rx_us);
+    return;
+  }
+
+  const char *name = doc["cmd"] | "";
+  for (size_t i = 0; i < sizeof(_tcpCmds) / sizeof(_tcpCmds[0]); i++) {
+    TcpCmd_st *cmd = &_tcpCmds[i];
+    if (strcmp(name, cmd->name) != 0) {
+      continue;
+    }
+
+    bool ok = cmd->handler(client, doc);
+    uint32_t us = micros() - rx_us;
+    cmd->count++;
+    if (us > cmd->max_us) {
+      cmd->max_us = us;
     }
+    log_i("Command %s from client %d: %s in %u us (max %u us, %u calls)", cmd->name, client, ok? "ok" : "failed", us, cmd->max_us, cmd->count);
+    LocalSendTcpAck(client, cmd->name, ok, us);
+    return;
   }
+
+  log_e("Unknown command from client %d: %s", client, name);
+  LocalSendTcpAck(client, name, false, micros() - rx_us);
 }
 
-void LocalSendTcpResponse(bool ret)
+/* Complete lines inside a chunk are parsed straight from the ring slot, only a line split across chunks is copied */
+static void LocalSplitLines(TcpLine_st *line, const TcpRxChunk_st *chunk)
 {
-  String response = String("{\"message\":\"") + (ret? String("success") : String("failed")) + String("\"}");
-  SERVER_Send(response);
+  const char *p = (const char *)chunk->data;
+  const char *end = p + chunk->len;
+
+  while (p < end) {
+    const char *nl = (const char *)memchr(p, '\n', end - p);
+    size_t n = (nl? nl : end) - p;
+
+    if (nl && line->len == 0 && ! line->overflow) {
+      LocalDispatchLine(chunk->client, p, n, chunk->rx_us);
+    } else {
+      if (line->len + n <= sizeof(line->buf)) {
+        memcpy(&line->buf[line->len], p, n);
+        line->len += n;
+      } else {
+        line->overflow = true;
+      }
+
+      if (nl) {
+        if (line->overflow) {
+          log_e("Command line from client %d longer than %d, dropped", chunk->client, TCP_LINE_MAX);
+        } else {
+          LocalDispatchLine(chunk->client, line->buf, line->len, chunk->rx_us);
+        }
+        line->len = 0;
+        line->overflow = false;
+      }
+    }
+
+    p += n + (nl? 1 : 0);
+  }
 }
 
 void tcp_handler_task(void *param)
 {
-  QueueMsg_st msg;
+  static TcpLine_st lines[TCP_CLIENT_MAX];
+  uint32_t lastDropped = 0;
 
   while (1)
   {
-    if (xQueueReceive(_tcpQ, &msg, portMAX_DELAY) == pdTRUE)
-    {
-      if (msg.data && msg.len)
-      {
-        JsonDocument doc;
-        DeserializationError error = deserializeJson(doc, msg.data, msg.len);
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 
-        if (error == DeserializationError::Ok) {
-          
+    TcpRxChunk_st *chunk;
+    while ((chunk = _tcpRxRing.PopBegin()) != NULL)
+    {
+      if (0 <= chunk->client && chunk->client < TCP_CLIENT_MAX) {
+        TcpLine_st *line = &lines[chunk->client];
+        if (chunk->len == 0) {
+          line->len = 0;
+          line->overflow = false;
+        } else {
+          LocalSplitLines(line, chunk);
         }
       }
 
-      /* Free resources */
-      if (msg.data)
-      {
-        free(msg.data);
-        msg.data = NULL;
-      }
-      msg.len = 0;
+      _tcpRxRing.PopCommit();
+    }
+
+    if (_tcpRxRing.Dropped() != lastDropped) {
+      log_e("TCP rx ring dropped %u (high water %u/%u)", _tcpRxRing.Dropped() - lastDropped, _tcpRxRing.HighWater(), _tcpRxRing.Capacity());
+      lastDropped = _tcpRxRing.Dropped();
     }
   }
 }
@@ -4,6 +4,11 @@ const readline = require("readline");
 const dgram = require('dgram');
 const net = require('net');
 const fs = require("fs");
+const {
+  SNAPSHOT_MAGIC, SNAPSHOT_FLAG_HISTORY, SNAPSHOT_mA_SCALE, SNAPSHOT_mV_SCALE,
+  SNAPSHOT_PACKED_SMOKE, SNAPSHOT_PACKED_FIRE, SNAPSHOT_PACKED_ALARM_VALID, SNAPSHOT_PACKED_CHARGE_VALID,
+  SNAPSHOT_PACKED_CHARGE_SHIFT, crc16, nextSnapshotFrame, decodeSnapshotDevices, decodeHistory
+} = require("./snapshot");
 const nodemailer = require("nodemailer");
 
 // ===== ALERT EMAIL CONFIG =====
@@ -80,6 +85,7 @@ async function sendAlertEmail(lockerId, type) {
 const SENSOR_STATUS_NOT_CHARGE = 0;
 const SENSOR_STATUS_CHARGING = 1;
 const SENSOR_STATUS_FULL_CHARGED = 2;
+const SENSOR_STATUS_TAPERING = 3;     // Only from nodes that classify on-device
 const SENSOR_FULL_CHARGED_DELAY = 5;
 
 const CU_DEVICE_ID = 0;
@@ -104,11 +110,48 @@ let tcpReconnectDelay = TCP_RECONNECT_BASE_MS;
 
 const CMD_GET_CURRENT_mA = 0x00;
 const CMD_SET_THRESHOLD = 0x01;
+const CMD_SET_BAUDRATE = 0x02;
+const CMD_GET_ALARM = 0x03;
+const CMD_ACK_ALARM = 0x04;
+const CMD_REGISTERS = 0x05;
+const REG_TYPE_READ = 0;
+const REG_TYPE_WRITE = 1;
+const REG_STATUS_OK = 0;
+const REG_COUNT_MAX = 16;
+
+// Node register map, 16 bit each, same order as the firmware's SensorReg_e
+const SENSOR_REG_FULL_mA = 0;
+const SENSOR_REG_NOTCHARGED_mA = 1;
+const SENSOR_REG_SAMPLE_HZ = 2;
+const SENSOR_REG_REPORT_PERIOD_MS = 3;
+const SENSOR_REG_FILTER_SHIFT = 4;
+const SENSOR_REG_REPORT_MODE = 5;
+const SENSOR_REG_CALIBRATION = 6;
+const SENSOR_REG_MAX = 7;
 const ID_BROADCAST = 0x00;
 
 let sensorDevices = [];
 let sensorResolver = null;
 let sensorTimeoutHdl = null;
+let bulkCollector = null;
+
+// Broadcast poll: each node replies (id - firstId) slots after the request,
+// a slot is one reply's air time at the current baud plus skew between nodes
+const BULK_SLOT_GUARD_MS = 2;
+const BULK_GUARD_MS = 50;
+const FRAME_OVERHEAD = 6;           // STX LEN ID CRC_H CRC_L ETX
+
+// Nodes ack SET_BAUDRATE at the old rate and switch this long after the request
+const SENSOR_BAUD_DEFAULT = 115200;
+const BAUD_SWITCH_DELAY_MS = 300;
+const BAUD_FALLBACK_MISSES = 3;
+let sensorBaud = SENSOR_BAUD_DEFAULT;
+let pollMissCount = 0;
+let baudNegotiating = false;
+
+// Alarm scan: nodes only answer while a smoke/fire change is unacknowledged, an idle scan is one short frame
+const ALARM_SCAN_INTERVAL_MS = 50;
+const ALARM_SCAN_GUARD_MS = 10;
 
 const WIRED_DEVICE_ID = [ 5, 6, 7, 8 ];
 
@@ -187,33 +230,57 @@ function connectTcp() {
   tcpSocket.on('connect', () => {
     console.log('[TCP] Connected');
     tcpReconnectDelay = TCP_RECONNECT_BASE_MS;
+    snapshotRxBuf = Buffer.alloc(0);
+    snapshotSeq = null;
+    snapshotBase = null;
+    tcpStreamLegacy = null;
+    sendThresholds();
   });
 
   tcpSocket.on('data', (chunk) => {
-    try {
-      let tmpDevices = parseSensorDevices(chunk);
-
-      tmpDevices.forEach(dev => {
-        let found = sensorDevices.find(o => o.id === dev.id);
-        if (found) {
-          if (notchargeThreshold < dev.mA && dev.mA < sensorThreshold) {
-            found.full_cnt++;
-          } else {
-            found.full_cnt = 0;
-          }
-          found.mA = dev.mA;
-          found.V = dev.V;
-        } else {
-          sensorDevices.push({
-            ...dev,
-            lock: false,
-            full_cnt: 0
-          });
-        }
-      });
+    snapshotRxBuf = Buffer.concat([snapshotRxBuf, chunk]);
+
+    if (tcpStreamLegacy === null) {
+      if (snapshotRxBuf.length < SNAPSHOT_MAGIC.length) return;
+      tcpStreamLegacy = !isSnapshotStreamStart(snapshotRxBuf);
+      if (tcpStreamLegacy) console.log('[TCP] Master sends the legacy device list');
+    }
+
+    if (tcpStreamLegacy) {
+      let devices;
+      while ((devices = nextLegacyDevices())) {
+        mergeSensorDevices(devices);
+      }
+      return;
+    }
+
+    while (true) {
+      if (snapshotRxBuf[0] === ACK_LINE_START) {
+        const nl = snapshotRxBuf.indexOf(0x0A);
+        if (nl === -1 && snapshotRxBuf.length <= ACK_LINE_MAX) break;
+        // An overlong line is junk, skip a byte and let the frame parser resync
+        const end = nl === -1 ? 1 : nl + 1;
+        handleCommandAck(snapshotRxBuf.subarray(0, end));
+        snapshotRxBuf = snapshotRxBuf.subarray(end);
+        continue;
+      }
+
+      const { frame, rest } = nextSnapshotFrame(snapshotRxBuf);
+      snapshotRxBuf = rest;
+      if (!frame) break;
+
+      if (frame.flags & SNAPSHOT_FLAG_HISTORY) {
+        handleHistoryFrame(frame);
+        continue;
+      }
 
-      handleSensorDevice(sensorDevices);
-    } catch { /* wait more */ }
+      if (snapshotSeq !== null && frame.seq !== ((snapshotSeq + 1) & 0xFFFF)) {
+        console.log(`⚠️ Snapshot gap: ${snapshotSeq} -> ${frame.seq}`);
+      }
+      snapshotSeq = frame.seq;
+
+      mergeSensorDevices(parseSensorDevices(frame));
+    }
   });
 
   tcpSocket.on('close', () => {
@@ -241,19 +308,143 @@ function scheduleReconnect() {
 }
 // ========================
 
-// ===== CRC16 (Modbus) =====
-function crc16(buf) {
-  let crc = 0xFFFF;
-  for (let b of buf) {
-    crc ^= b;
-    for (let i = 0; i < 8; i++) {
-      if (crc & 1) crc = (crc >> 1) ^ 0xA001;
-      else crc >>= 1;
-    }
+// ===== SNAPSHOT STREAM =====
+// Framing, CRC and the packed device records are decoded in snapshot.js
+let snapshotRxBuf = Buffer.alloc(0);
+let snapshotSeq = null;
+let snapshotBase = null;  // { seq, values: Map(id -> { mA, mV }) } from the last keyframe
+
+// Masters without the snapshot stream send COUNT | COUNT x (ID | mA f32 | V f32) every 2 s, unframed.
+// The first bytes of a connection tell the two apart: a snapshot "LK" or an ack line '{'.
+const LEGACY_DEVICE_SIZE = 9;
+let tcpStreamLegacy = null;
+
+function isSnapshotStreamStart(buf) {
+  return buf[0] === ACK_LINE_START || (buf[0] === SNAPSHOT_MAGIC[0] && buf[1] === SNAPSHOT_MAGIC[1]);
+}
+
+function nextLegacyDevices() {
+  if (snapshotRxBuf.length < 1) return null;
+
+  const count = snapshotRxBuf[0];
+  const len = 1 + count * LEGACY_DEVICE_SIZE;
+  if (snapshotRxBuf.length < len) return null;
+
+  const devices = [];
+  for (let start = 1; start < len; start += LEGACY_DEVICE_SIZE) {
+    devices.push({
+      id: snapshotRxBuf[start],
+      mA: Math.round(Math.abs(snapshotRxBuf.readFloatLE(start + 1))) >>> 0,
+      V: Math.round(Math.abs(snapshotRxBuf.readFloatLE(start + 5))) >>> 0
+    });
   }
-  return crc & 0xFFFF;
+  snapshotRxBuf = snapshotRxBuf.subarray(len);
+  return devices;
 }
 
+// Pulls the next verified frame out of a stream buffer, resyncing on the magic after garbage
+// ===== Command channel =====
+// Commands are JSON lines, the master answers each with {"ack":cmd,"ok":bool,"us":latency}\n
+const ACK_LINE_START = 0x7B;  // '{', snapshot frames start with 'L'
+const ACK_LINE_MAX = 256;
+
+function handleCommandAck(line) {
+  try {
+    const ack = JSON.parse(line.toString());
+    console.log(`[TCP] ${ack.ack || '?'} ${ack.ok ? 'ok' : 'failed'} in ${ack.us} us`);
+  } catch (e) {
+    console.log("❌ Bad command ack:", line.toString().trim());
+  }
+}
+
+function sendThresholds() {
+  sendTcp({ cmd: "threshold", full: sensorThreshold, notcharged: notchargeThreshold });
+}
+
+// One broadcast writes the same registers on every node, each validates the whole range before applying it
+async function writeRegisters(start, values, ids = WIRED_DEVICE_ID) {
+  const data = [REG_TYPE_WRITE, start, values.length];
+  for (const v of values) data.push(v & 0xFF, (v >> 8) & 0xFF);
+  const acks = await broadcastAndCollect(CMD_REGISTERS, data, ids);
+  return [...acks.values()].filter(p => p[3] === CMD_REGISTERS && p[4] === REG_TYPE_WRITE && p[7] === REG_STATUS_OK).length;
+}
+
+// Wired nodes keep their own copy for the on-device classifier
+async function sendWiredThresholds() {
+  const accepted = await writeRegisters(SENSOR_REG_FULL_mA, [sensorThreshold, notchargeThreshold]);
+  console.log(`[SENSOR] ${accepted}/${WIRED_DEVICE_ID.length} nodes took thresholds ${sensorThreshold}/${notchargeThreshold} mA`);
+}
+// ========================
+
+// ===== HISTORY =====
+// The master keeps per-device rings: raw reports, 1 min and 15 min means, stamped in seconds since its boot
+const HISTORY_TIERS = { raw: 0, '1m': 1, '15m': 2 };
+const HISTORY_TIMEOUT_MS = 2000;
+let historyWaiters = [];
+
+function parseHistoryFrame(frame) {
+  const history = decodeHistory(frame);
+
+  // Map the master's uptime onto wall clock time
+  const bootMs = Date.now() - (history.now_ms || 0);
+  history.samples = history.samples.map(smp => ({
+    ts_s: smp.ts_s,
+    mA: smp.mA,
+    V: smp.mV / SNAPSHOT_mV_SCALE,
+    time: new Date(bootMs + smp.ts_s * 1000).toISOString()
+  }));
+  return history;
+}
+
+function handleHistoryFrame(frame) {
+  const history = parseHistoryFrame(frame);
+  const idx = historyWaiters.findIndex(w => w.id === history.id && w.tier === history.tier);
+  if (idx === -1) return;
+
+  const waiter = historyWaiters.splice(idx, 1)[0];
+  clearTimeout(waiter.timer);
+  waiter.resolve(history);
+}
+
+function requestHistory(id, tier, from, to) {
+  return new Promise((resolve) => {
+    const waiter = { id, tier, resolve };
+    waiter.timer = setTimeout(() => {
+      historyWaiters = historyWaiters.filter(w => w !== waiter);
+      resolve(null);
+    }, HISTORY_TIMEOUT_MS);
+    historyWaiters.push(waiter);
+    sendTcp({ cmd: "history", id, tier, from, to });
+  });
+}
+// ========================
+
+function mergeSensorDevices(devices) {
+  devices.forEach(dev => {
+    let found = sensorDevices.find(o => o.id === dev.id);
+    if (found) {
+      if (notchargeThreshold < dev.mA && dev.mA < sensorThreshold) {
+        found.full_cnt++;
+      } else {
+        found.full_cnt = 0;
+      }
+      Object.assign(found, dev);
+      if (dev.smoke !== undefined) {
+        handleSmokeFire(dev.id, dev.smoke, dev.fire);
+      }
+    } else {
+      sensorDevices.push({
+        ...dev,
+        lock: false,
+        full_cnt: 0
+      });
+    }
+  });
+
+  handleSensorDevice(sensorDevices);
+}
+// ========================
+
 function cuLockCheckSum(arr) {
     let sum = 0;
     for (let i of arr) {
@@ -262,22 +453,6 @@ function cuLockCheckSum(arr) {
     return sum & 0xff;
 }
 
-function crc16_modbus(buffer) {
-  let crc = 0xFFFF;
-  for (let i = 0; i < buffer.length; i++) {
-    crc ^= buffer[i];
-    for (let j = 0; j < 8; j++) {
-      if (crc & 0x0001) {
-        crc >>= 1;
-        crc ^= 0xA001;
-      } else {
-        crc >>= 1;
-      }
-    }
-  }
-  return crc & 0xFFFF;
-}
-
 function dumpArrayHex(header, arr) {
   console.log(header, arr.toString('hex').match(/.{1,2}/g).join(' '));
 }
@@ -305,7 +480,7 @@ function buildPacket(id, cmd, data) {
   const len = 4 + data.length; // ID + CMD + DATA
   const payload = [len, id, cmd, ...data];
 
-  const crc = crc16_modbus(Buffer.from(payload));
+  const crc = crc16(Buffer.from(payload));
   const crc_h = (crc >> 8) & 0xFF;
   const crc_l = crc & 0xFF;
 
@@ -365,32 +540,30 @@ function questionAsync(prompt) {
   return new Promise((resolve) => rl.question(prompt, (ans) => { rl.close(); resolve(ans); }));
 }
 
-function parseSensorDevices(byteArray) {
-  if (!byteArray || byteArray.length < 1) return [];
-
-  const buf = Buffer.from(byteArray);
-  const deviceCount = buf[0];
-  const devices = [];
-
-  for (let i = 0; i < deviceCount; i++) {
-    let start = 1 + i * 9;
-    if (start + 9 > buf.length) {
-      console.log("❌ Invalid packet length:", buf.length);
-      break; // out of range
-    }
-
-    let deviceId = buf[start];
-    let current = Math.round(Math.abs(buf.readFloatLE(start + 1))) >>> 0; // mA
-    let voltage = Math.round(Math.abs(buf.readFloatLE(start + 5))) >>> 0; // V
-
-    devices.push({
-      id: deviceId,
-      mA: current,
-      V: voltage
-    });
+function parseSensorDevices(frame) {
+  const snapshot = decodeSnapshotDevices(frame, snapshotBase);
+  snapshotBase = snapshot.base;
+  if (!snapshot.devices) {
+    console.log(`⚠️ Snapshot ${frame.seq} needs keyframe ${snapshot.baseSeq}, dropped`);
+    return [];
   }
 
-  return devices;
+  return snapshot.devices.map(e => {
+    const dev = {
+      id: e.id,
+      mA: Math.round(Math.abs(e.mA / SNAPSHOT_mA_SCALE)) >>> 0,
+      V: Math.round(Math.abs(e.mV / SNAPSHOT_mV_SCALE)) >>> 0,
+      age_ms: e.age_ms
+    };
+    if (e.flags & SNAPSHOT_PACKED_ALARM_VALID) {
+      dev.smoke = (e.flags & SNAPSHOT_PACKED_SMOKE) ? 1 : 0;
+      dev.fire = (e.flags & SNAPSHOT_PACKED_FIRE) ? 1 : 0;
+    }
+    if (e.flags & SNAPSHOT_PACKED_CHARGE_VALID) {
+      dev.charge = (e.flags >> SNAPSHOT_PACKED_CHARGE_SHIFT) & 0x03;
+    }
+    return dev;
+  });
 }
 
 function getSensorStatus(current_mA) {
@@ -403,12 +576,25 @@ function getSensorStatus(current_mA) {
   }
 }
 
+// Nodes report a debounced state byte, older firmware only mA
+function getDeviceStatus(dev) {
+  return dev.charge !== undefined ? dev.charge : getSensorStatus(dev.mA);
+}
+
+function isFullCharged(dev) {
+  if (dev.charge !== undefined) {
+    return dev.charge === SENSOR_STATUS_FULL_CHARGED;
+  }
+  return getSensorStatus(dev.mA) === SENSOR_STATUS_FULL_CHARGED && dev.full_cnt >= SENSOR_FULL_CHARGED_DELAY;
+}
+
 function getSensorStatusString(status) {
   if (status === SENSOR_STATUS_NOT_CHARGE) {
     return "notcharge";
   } else if (status === SENSOR_STATUS_FULL_CHARGED) {
     return "fullcharged";
   } else {
+    // Tapering is still charging for API clients
     return "charging";
   }
 }
@@ -439,8 +625,7 @@ async function handleSensorDevice(devices) {
   // console.log("Devices:", devices);
 
   for (let dev of devices) {
-    let status = getSensorStatus(dev.mA);
-    if (status == SENSOR_STATUS_FULL_CHARGED && dev.full_cnt >= SENSOR_FULL_CHARGED_DELAY) {
+    if (isFullCharged(dev)) {
       if (dev.lock === true) {
         // cuLockOpen(CU_DEVICE_ID, dev.id);
         // await delay(250);
@@ -470,6 +655,200 @@ function sendAndWait(pkt, timeout = 100) {
   });
 }
 
+// One broadcast on the sensor bus at a time, alarm scans and status polls queue behind each other
+let bulkQueue = Promise.resolve();
+
+function broadcastAndCollect(cmd, data, ids, guard = BULK_GUARD_MS) {
+  const run = bulkQueue.then(() => collectBroadcast(cmd, data, ids, guard));
+  bulkQueue = run.catch(() => {});
+  return run;
+}
+
+// Longest reply payload a node sends for a broadcast request
+function replyPayloadLen(cmd, data) {
+  switch (cmd) {
+    case CMD_GET_CURRENT_mA: return 12;
+    case CMD_GET_ALARM: return 6;
+    case CMD_REGISTERS: return 5 + (data[0] === REG_TYPE_READ ? data[2] * 2 : 0);
+    default: return 2;
+  }
+}
+
+function slotTimeMs(payloadLen) {
+  const airMs = Math.ceil((FRAME_OVERHEAD + payloadLen) * 10 * 1000 / sensorBaud);
+  return Math.min(airMs + BULK_SLOT_GUARD_MS, 0xFF);
+}
+
+function collectBroadcast(cmd, data, ids, guard) {
+  const firstId = Math.min(...ids);
+  const lastId = Math.max(...ids);
+  const slotTime = slotTimeMs(replyPayloadLen(cmd, data));
+  const window = (lastId - firstId + 1) * slotTime + guard;
+
+  return new Promise((resolve) => {
+    const responses = new Map();
+    const finish = () => {
+      if (bulkCollector && bulkCollector.responses === responses) {
+        clearTimeout(bulkCollector.timer);
+        bulkCollector = null;
+        resolve(responses);
+      }
+    };
+
+    bulkCollector = {
+      responses,
+      expected: ids.length,
+      finish,
+      timer: setTimeout(finish, window)
+    };
+
+    const pkt = buildPacket(ID_BROADCAST, cmd, [...data, firstId, slotTime]);
+    ssPort.write(pkt, (err) => {
+      if (err) {
+        console.error("❌ Write error:", err.message);
+        finish();
+      }
+    });
+  });
+}
+
+function pollAllDevices(ids) {
+  return broadcastAndCollect(CMD_GET_CURRENT_mA, [], ids);
+}
+
+// Smoke/fire emergency: open lock immediately and send alert email
+function handleSmokeFire(id, smoke, fire) {
+  if (smoke || fire) {
+    if (!smokeFireAlerted.has(id)) {
+      smokeFireAlerted.add(id);
+      const alertType = fire ? 'Fire' : 'Smoke';
+      console.log(`[ALERT] ${alertType} detected at locker ${id}! Opening lock...`);
+      cuLockOpen(CU_DEVICE_ID, id);
+      sendAlertEmail(id, alertType);
+    }
+  } else {
+    smokeFireAlerted.delete(id); // reset so future events trigger again
+  }
+}
+
+// Reply: STX LEN ID CMD ALARMS LATCHED SEQ AGE_L AGE_H CRC_H CRC_L ETX
+async function scanAlarms() {
+  // Share the bus with status polls and never talk across a baudrate switch
+  if (bulkCollector || sensorResolver || baudNegotiating) return;
+
+  const responses = await broadcastAndCollect(CMD_GET_ALARM, [], WIRED_DEVICE_ID, ALARM_SCAN_GUARD_MS);
+  for (const [id, resp] of responses) {
+    if (resp.length < 12 || resp[3] !== CMD_GET_ALARM) continue;
+
+    const alarms = resp[4] | resp[5];
+    const seq = resp[6];
+    const smoke = (alarms & 0x01) !== 0;
+    const fire = (alarms & 0x02) !== 0;
+    console.log(`[ALARM] ${id}: smoke ${smoke}, fire ${fire}, ${resp.readUInt16LE(7)} ms after the edge`);
+
+    const found = sensorDevices.find(o => o.id === id);
+    if (found) {
+      found.smoke = smoke;
+      found.fire = fire;
+    }
+    handleSmokeFire(id, smoke, fire);
+    ssPort.write(buildPacket(id, CMD_ACK_ALARM, [seq]));
+  }
+}
+
+function setSensorBaud(baud) {
+  return new Promise((resolve) => {
+    ssPort.update({ baudRate: baud }, (err) => {
+      if (err) {
+        console.error("⚠️ [SENSOR] Baudrate update failed:", err.message);
+      } else {
+        sensorBaud = baud;
+        console.log(`[SENSOR] Baudrate ${baud}`);
+      }
+      resolve();
+    });
+  });
+}
+
+async function negotiateBaudrate(baud) {
+  baudNegotiating = true;
+  try {
+    return await negotiateBaudrateSteps(baud);
+  } finally {
+    baudNegotiating = false;
+  }
+}
+
+async function negotiateBaudrateSteps(baud) {
+  const start = Date.now();
+  const baudBytes = [baud & 0xFF, (baud >> 8) & 0xFF, (baud >> 16) & 0xFF, (baud >>> 24) & 0xFF];
+  const acks = await broadcastAndCollect(CMD_SET_BAUDRATE, baudBytes, WIRED_DEVICE_ID);
+  const accepted = [...acks.values()].filter(p => p[3] === CMD_SET_BAUDRATE && p[4] === 1).length;
+  console.log(`[SENSOR] ${accepted}/${WIRED_DEVICE_ID.length} nodes accepted ${baud} baud`);
+  if (accepted === 0) {
+    return false;
+  }
+
+  await delay(Math.max(0, BAUD_SWITCH_DELAY_MS + BULK_GUARD_MS - (Date.now() - start)));
+  await setSensorBaud(baud);
+
+  // Nodes keep the new rate only once they see good frames, otherwise they fall back on their own
+  const responses = await pollAllDevices(WIRED_DEVICE_ID);
+  if (responses.size === 0) {
+    console.log(`❌ [SENSOR] No reply at ${baud}, back to ${SENSOR_BAUD_DEFAULT}`);
+    await setSensorBaud(SENSOR_BAUD_DEFAULT);
+    return false;
+  }
+
+  pollMissCount = 0;
+  return true;
+}
+
+function handleSensorPacket(packet) {
+  if (bulkCollector) {
+    if (packet[2] === ID_BROADCAST) return;
+    bulkCollector.responses.set(packet[2], packet);
+    if (bulkCollector.responses.size >= bulkCollector.expected) {
+      bulkCollector.finish();
+    }
+  } else if (sensorResolver) {
+    clearTimeout(sensorTimeoutHdl);
+    sensorResolver(packet);
+    sensorResolver = null;
+  } else {
+    console.log("No Resolver");
+  }
+}
+
+// Frames are length delimited: STX | LEN | ID | DATA | CRC_H | CRC_L | ETX,
+// LEN counts ID through CRC. Payload bytes may equal STX/ETX.
+function nextSensorPacket(buf) {
+  while (buf.length > 0) {
+    const stx = buf.indexOf(0x02);
+    if (stx === -1) {
+      return { packet: null, rest: Buffer.alloc(0) };
+    }
+
+    buf = buf.subarray(stx);
+    if (buf.length < 2) break;
+
+    const frameLen = buf[1] + 3;
+    if (buf[1] < 3) {
+      buf = buf.subarray(1);
+      continue;
+    }
+    if (buf.length < frameLen) break;
+
+    const packet = buf.subarray(0, frameLen);
+    if (validatePacket(packet)) {
+      return { packet, rest: buf.subarray(frameLen) };
+    }
+    buf = buf.subarray(1);
+  }
+
+  return { packet: null, rest: buf };
+}
+
 function sendNoWait(pkt) {
   port.write(pkt, (err) => {
   if (err) console.error("❌ Write error:", err.message);
@@ -605,7 +984,7 @@ async function main() {
   } while (ssPortIdx < 0 || ssPortIdx >= ports.length );//|| ssPortIdx == cuPortIdx);
 
   const ssPath = ports[ssPortIdx].path;
-  const ssBaud = 115200;
+  const ssBaud = SENSOR_BAUD_DEFAULT;
   ssPort = new SerialPort({ path: ssPath, baudRate: ssBaud, autoOpen: false });
 
   /* Init Sensor COM port */
@@ -615,25 +994,11 @@ async function main() {
     // dumpArrayHex("[RX] [SENSOR]", chunk)
 
     recvBuffer = Buffer.concat([recvBuffer, chunk]);
-    while (recvBuffer.length >= 7) {
-      const stx = recvBuffer.indexOf(0x02);
-      const etx = recvBuffer.indexOf(0x03, stx + 1);
-      if (stx === -1 || etx === -1) break;
-
-      const packet = recvBuffer.slice(stx, etx + 1);
-      recvBuffer = recvBuffer.slice(etx + 1);
-
-      if (validatePacket(packet)) {
-        if (sensorResolver) {
-            clearTimeout(sensorTimeoutHdl);
-            sensorResolver(packet);
-            sensorResolver = null;
-          } else {
-          console.log("No Resolver");
-        }
-      } else {
-        console.log("CRC failed");
-      }
+    while (true) {
+      const { packet, rest } = nextSensorPacket(recvBuffer);
+      recvBuffer = rest;
+      if (!packet) break;
+      handleSensorPacket(packet);
     }
   });
 
@@ -643,14 +1008,28 @@ async function main() {
   await new Promise((res, rej) => cuPort.open((err) => (err ? rej(err) : res())));
   await new Promise((res, rej) => ssPort.open((err) => (err ? rej(err) : res())));
 
+  if (store.sensorBaud && store.sensorBaud !== SENSOR_BAUD_DEFAULT) {
+    await negotiateBaudrate(store.sensorBaud);
+  }
+  await sendWiredThresholds();
+
   const server = http.createServer(async (req, res) => {
     if (req.method === "POST" && req.url === "/getStatus") {
       let results = [];
 
       // console.log("Retrieving device status...");
+      const responses = await pollAllDevices(WIRED_DEVICE_ID);
+      if (responses.size === 0 && sensorBaud !== SENSOR_BAUD_DEFAULT) {
+        if (++pollMissCount >= BAUD_FALLBACK_MISSES) {
+          console.log(`❌ [SENSOR] No reply at ${sensorBaud}, back to ${SENSOR_BAUD_DEFAULT}`);
+          await setSensorBaud(SENSOR_BAUD_DEFAULT);
+          pollMissCount = 0;
+        }
+      } else {
+        pollMissCount = 0;
+      }
       for (let id of WIRED_DEVICE_ID) {
-        const pkt = buildPacket(id, CMD_GET_CURRENT_mA);
-        const resp = await sendAndWait(pkt, 100);
+        const resp = responses.get(id);
         if (resp) {
 		      const mADataBytes = resp.slice(3, 7);
 		      const mA = Math.round(Math.abs(mADataBytes.readFloatLE(0)));
@@ -658,7 +1037,9 @@ async function main() {
           const V = Math.round(Math.abs(vDataBytes.readFloatLE(0)));
           const smoke = resp.length > 11 ? resp[11] !== 0 : false;
           const fire  = resp.length > 12 ? resp[12] !== 0 : false;
-          let statusStr = getSensorStatusString(getSensorStatus(mA));
+          // ... CHARGE CONFIDENCE CRC_H CRC_L ETX from nodes that classify on-device
+          const charge = resp.length >= 18 ? resp[13] : undefined;
+          const confidence = resp.length >= 18 ? resp[14] : undefined;
 
           let found = sensorDevices.find(o => o.id === id);
           let lock = false;
@@ -672,19 +1053,10 @@ async function main() {
             found.V = V;
             found.smoke = smoke;
             found.fire  = fire;
+            found.charge = charge;
+            found.confidence = confidence;
 
-            // Smoke/fire emergency: open lock immediately and send alert email
-            if (smoke || fire) {
-              if (!smokeFireAlerted.has(id)) {
-                smokeFireAlerted.add(id);
-                const alertType = fire ? 'Fire' : 'Smoke';
-                console.log(`[ALERT] ${alertType} detected at locker ${id}! Opening lock...`);
-                cuLockOpen(CU_DEVICE_ID, id);
-                sendAlertEmail(id, alertType);
-              }
-            } else {
-              smokeFireAlerted.delete(id); // reset so future events trigger again
-            }
+            handleSmokeFire(id, smoke, fire);
 
             lock = found.lock;
           } else {
@@ -695,7 +1067,9 @@ async function main() {
               lock: false,
               full_cnt: 0,
               smoke: smoke,
-              fire: fire
+              fire: fire,
+              charge: charge,
+              confidence: confidence
             });
           }
 
@@ -706,14 +1080,60 @@ async function main() {
       }
 
       for (let dev of sensorDevices) {   
-        let statusStr = getSensorStatusString(getSensorStatus(dev.mA));
-        results.push({ id: dev.id, mA: dev.mA, V: dev.V, status: statusStr, lock: dev.lock, smoke: dev.smoke || false, fire: dev.fire || false });
+        let statusStr = getSensorStatusString(getDeviceStatus(dev));
+        results.push({ id: dev.id, mA: dev.mA, V: dev.V, status: statusStr, confidence: dev.confidence, lock: dev.lock, smoke: dev.smoke || false, fire: dev.fire || false });
       }
 
       const json = JSON.stringify({ results }, null, 2);
       res.writeHead(200, { "Content-Type": "application/json" });
       res.end(json);
     }
+    else if (req.method === "POST" && req.url === "/setBaudrate") {
+      let body = "";
+      req.on("data", (chunk) => (body += chunk));
+      req.on("end", async () => {
+        try {
+          const data = JSON.parse(body);
+          const baud = data.baud;
+          if (typeof baud !== "number") {
+            res.writeHead(400);
+            res.end("Invalid baudrate");
+          } else {
+            const ok = (baud === sensorBaud) || await negotiateBaudrate(baud);
+            if (ok) {
+              store.sensorBaud = baud;
+              saveStore(store);
+            }
+            res.writeHead(ok ? 200 : 400, { "Content-Type": "application/json" });
+            res.end(JSON.stringify({ message: ok ? 'Success' : 'Failed', baud: sensorBaud }, null, 2));
+          }
+        } catch (e) {
+          res.writeHead(400);
+          res.end("Invalid JSON");
+        }
+      });
+    }
+    else if (req.method === "POST" && req.url === "/history") {
+      let body = "";
+      req.on("data", (chunk) => (body += chunk));
+      req.on("end", async () => {
+        try {
+          const data = JSON.parse(body);
+          const tier = HISTORY_TIERS[data.tier || 'raw'];
+          if (typeof data.id !== "number" || tier === undefined) {
+            res.writeHead(400);
+            res.end("Invalid history request");
+          } else {
+            const history = await requestHistory(data.id, tier, data.from || 0, data.to ?? 0xFFFFFFFF);
+            res.writeHead(history ? 200 : 504, { "Content-Type": "application/json" });
+            res.end(JSON.stringify(history || { message: 'No reply from master' }, null, 2));
+          }
+        } catch (e) {
+          res.writeHead(400);
+          res.end("Invalid JSON");
+        }
+      });
+    }
     else if (req.method === "POST" && req.url === "/setThreshold") {
       let body = "";
       req.on("data", (chunk) => (body += chunk));
@@ -731,6 +1151,8 @@ async function main() {
             notchargeThreshold = notcharged;
             store.notcharged = notchargeThreshold;
             saveStore(store);
+            sendThresholds();
+            sendWiredThresholds();
             let msg = "✅ Full Charged: " + sensorThreshold + "(mA), Not Charged:" + notchargeThreshold + "(mA)";
             console.log(msg);
             res.writeHead(200, { "Content-Type": "application/json" });
@@ -742,6 +1164,49 @@ async function main() {
         }
       });
     }
+    else if (req.method === "POST" && req.url === "/setSamplePeriod") {
+      let body = "";
+      req.on("data", (chunk) => (body += chunk));
+      req.on("end", async () => {
+        try {
+          const data = JSON.parse(body);
+          // ms: publish period, hz: sensor sample rate
+          if (typeof data.ms !== "number" && typeof data.hz !== "number") {
+            res.writeHead(400);
+            res.end("Invalid sample period");
+          } else {
+            sendTcp({ cmd: "period", ms: data.ms, hz: data.hz });
+            res.writeHead(200, { "Content-Type": "application/json" });
+            res.end(JSON.stringify({ message: "Sample period sent" }, null, 2));
+          }
+        } catch (e) {
+          res.writeHead(400);
+          res.end("Invalid JSON");
+        }
+      });
+    }
+    else if (req.method === "POST" && req.url === "/sensorRegisters") {
+      let body = "";
+      req.on("data", (chunk) => (body += chunk));
+      req.on("end", async () => {
+        try {
+          const data = JSON.parse(body);
+          const values = data.values;
+          if (typeof data.start !== "number" || !Array.isArray(values) || values.length === 0 || values.length > REG_COUNT_MAX ||
+              data.start + values.length > SENSOR_REG_MAX || values.some(v => !Number.isInteger(v) || v < 0 || v > 0xFFFF)) {
+            res.writeHead(400);
+            res.end("Invalid registers");
+          } else {
+            const accepted = await writeRegisters(data.start, values);
+            res.writeHead(200, { "Content-Type": "application/json" });
+            res.end(JSON.stringify({ message: 'Success', accepted, nodes: WIRED_DEVICE_ID.length }, null, 2));
+          }
+        } catch (e) {
+          res.writeHead(400);
+          res.end("Invalid JSON");
+        }
+      });
+    }
     else if (req.method === "POST" && req.url === "/unlock") {
       let body = "";
       req.on("data", (chunk) => (body += chunk));
@@ -758,9 +1223,7 @@ async function main() {
             if (found) {
               console.log("Found", found);
               if (found.lock) {
-                let status = getSensorStatus(found.mA);
-                if ((status === SENSOR_STATUS_FULL_CHARGED && found.full_cnt >= SENSOR_FULL_CHARGED_DELAY)
-                      || status == SENSOR_STATUS_NOT_CHARGE) {
+                if (isFullCharged(found) || getDeviceStatus(found) == SENSOR_STATUS_NOT_CHARGE) {
                   cuLockOpen(CU_DEVICE_ID, found.id);
                   await delay(250);
                   cuLockStatus(CU_DEVICE_ID);
@@ -796,6 +1259,8 @@ async function main() {
 
   }, 2000);
 
+  setInterval(scanAlarms, ALARM_SCAN_INTERVAL_MS);
+
   const PORT_HTTP = 3000;
   server.listen(PORT_HTTP, () => {
     console.log(`🌐 HTTP server listening on http://localhost:${PORT_HTTP}`);
@@ -0,0 +1,216 @@
+// ===== SNAPSHOT STREAM =====
+// Decoder for the master's snapshot stream, the reader side of master/snapshot_frame.h.
+// No sockets and no state of its own, so test/test_snapshot_roundtrip.js can drive it.
+//
+// MAGIC "LK" | VERSION | FLAGS | SEQ u16 | LEN u16 | RECORDS | CRC16 u16, little endian.
+// Records are TYPE | LEN | VALUE. Devices come in DEVICES_PACKED records:
+// ID | FLAGS | zigzag varint mA*10 | zigzag varint mV | varint age ms,
+// absolute on keyframes and deltas against the BASE_SEQ keyframe otherwise.
+const SNAPSHOT_MAGIC = Buffer.from('LK');
+const SNAPSHOT_VERSION = 2;
+const SNAPSHOT_HEADER_SIZE = 8;
+const SNAPSHOT_CRC_SIZE = 2;
+const SNAPSHOT_RECORDS_MAX = 8192;  // Largest snapshot the master can build is ~4.9 KB
+const SNAPSHOT_FLAG_KEYFRAME = 0x01;
+const SNAPSHOT_FLAG_HISTORY = 0x02;
+
+const SNAPSHOT_REC_TIMESTAMP = 0x01;
+const SNAPSHOT_REC_BASE_SEQ = 0x03;
+const SNAPSHOT_REC_DEVICES_PACKED = 0x20;
+const SNAPSHOT_REC_HISTORY_QUERY = 0x30;
+const SNAPSHOT_REC_HISTORY_SAMPLES = 0x31;
+
+const SNAPSHOT_mA_SCALE = 10;
+const SNAPSHOT_mV_SCALE = 1000;
+const SNAPSHOT_PACKED_SMOKE = 0x01;
+const SNAPSHOT_PACKED_FIRE = 0x02;
+const SNAPSHOT_PACKED_ALARM_VALID = 0x04;
+const SNAPSHOT_PACKED_CHARGE_VALID = 0x08;
+const SNAPSHOT_PACKED_CHARGE_SHIFT = 4;
+const SNAPSHOT_PACKED_ABSOLUTE = 0x80;
+
+// ===== CRC16 (Modbus) =====
+// Shared with the RS485 framing
+const CRC16_TABLE = (() => {
+  const table = new Uint16Array(256);
+  for (let i = 0; i < 256; i++) {
+    let crc = i;
+    for (let j = 0; j < 8; j++) {
+      crc = (crc & 1) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+    }
+    table[i] = crc;
+  }
+  return table;
+})();
+
+function crc16(buf) {
+  let crc = 0xFFFF;
+  for (let i = 0; i < buf.length; i++) {
+    crc = (crc >> 8) ^ CRC16_TABLE[(crc ^ buf[i]) & 0xFF];
+  }
+  return crc;
+}
+// ========================
+
+// Returns the first whole frame in buf and what follows it, skipping junk and frames with a bad CRC
+function nextSnapshotFrame(buf) {
+  while (buf.length > 0) {
+    const start = buf.indexOf(SNAPSHOT_MAGIC);
+    if (start === -1) {
+      // A trailing 'L' may be the first half of the next magic
+      const keep = buf[buf.length - 1] === SNAPSHOT_MAGIC[0] ? 1 : 0;
+      return { frame: null, rest: buf.subarray(buf.length - keep) };
+    }
+
+    buf = buf.subarray(start);
+    if (buf.length < SNAPSHOT_HEADER_SIZE) break;
+
+    const len = buf.readUInt16LE(6);
+    if (buf[2] !== SNAPSHOT_VERSION || len > SNAPSHOT_RECORDS_MAX) {
+      buf = buf.subarray(1);
+      continue;
+    }
+
+    const frameLen = SNAPSHOT_HEADER_SIZE + len + SNAPSHOT_CRC_SIZE;
+    if (buf.length < frameLen) break;
+
+    if (crc16(buf.subarray(2, frameLen - SNAPSHOT_CRC_SIZE)) !== buf.readUInt16LE(frameLen - SNAPSHOT_CRC_SIZE)) {
+      console.log("❌ Snapshot CRC error");
+      buf = buf.subarray(1);
+      continue;
+    }
+
+    const frame = {
+      flags: buf[3],
+      seq: buf.readUInt16LE(4),
+      records: buf.subarray(SNAPSHOT_HEADER_SIZE, frameLen - SNAPSHOT_CRC_SIZE)
+    };
+    return { frame, rest: buf.subarray(frameLen) };
+  }
+
+  return { frame: null, rest: buf };
+}
+
+function readVarint(buf, pos) {
+  let value = 0;
+  for (let shift = 0; shift < 35 && pos < buf.length; shift += 7) {
+    const byte = buf[pos++];
+    value += (byte & 0x7F) * 2 ** shift;
+    if ((byte & 0x80) === 0) return { value: value >>> 0, pos };
+  }
+  return null;
+}
+
+function unZigZag(value) {
+  return (value >>> 1) ^ -(value & 1);
+}
+
+// Calls fn(type, value) for every whole record, unknown types included
+function forEachRecord(records, fn) {
+  for (let pos = 0; pos + 2 <= records.length; ) {
+    const type = records[pos];
+    const len = records[pos + 1];
+    const value = records.subarray(pos + 2, pos + 2 + len);
+    pos += 2 + len;
+    if (value.length < len) {
+      console.log("❌ Truncated snapshot record:", type);
+      break;
+    }
+    fn(type, value);
+  }
+}
+
+// Resolves a live snapshot against base, the { seq, values: Map(id -> { mA, mV }) } of the last keyframe.
+// Returns { base, baseSeq, devices } with absolute fixed point values as the master packed them,
+// devices is null when the frame needs a keyframe that was never seen.
+function decodeSnapshotDevices(frame, base) {
+  const keyframe = (frame.flags & SNAPSHOT_FLAG_KEYFRAME) !== 0;
+  const entries = [];
+  let baseSeq = null;
+
+  forEachRecord(frame.records, (type, value) => {
+    if (type === SNAPSHOT_REC_BASE_SEQ && value.length >= 2) {
+      baseSeq = value.readUInt16LE(0);
+    } else if (type === SNAPSHOT_REC_DEVICES_PACKED) {
+      for (let p = 0; p + 2 <= value.length; ) {
+        const id = value[p];
+        const flags = value[p + 1];
+        const mA = readVarint(value, p + 2);
+        const mV = mA && readVarint(value, mA.pos);
+        const age = mV && readVarint(value, mV.pos);
+        if (!age) {
+          console.log("❌ Truncated packed device");
+          break;
+        }
+        entries.push({ id, flags, mA: unZigZag(mA.value), mV: unZigZag(mV.value), age_ms: age.value });
+        p = age.pos;
+      }
+    }
+  });
+
+  if (keyframe) {
+    base = { seq: frame.seq, values: new Map() };
+  } else if (!base || base.seq !== baseSeq) {
+    // Deltas against a keyframe we never saw, wait for the next one
+    return { base, baseSeq, devices: null };
+  }
+
+  const devices = [];
+  for (const e of entries) {
+    if (keyframe) {
+      base.values.set(e.id, { mA: e.mA, mV: e.mV });
+    } else if (!(e.flags & SNAPSHOT_PACKED_ABSOLUTE)) {
+      const prev = base.values.get(e.id);
+      if (!prev) continue;
+      e.mA += prev.mA;
+      e.mV += prev.mV;
+    }
+    devices.push(e);
+  }
+
+  return { base, baseSeq, devices };
+}
+
+// A history reply: { id, tier, now_ms, samples: [{ ts_s, mA, mV }] }, ts_s in seconds since the master's boot
+function decodeHistory(frame) {
+  const history = { id: null, tier: null, now_ms: null, samples: [] };
+
+  forEachRecord(frame.records, (type, value) => {
+    if (type === SNAPSHOT_REC_TIMESTAMP && value.length >= 4) {
+      history.now_ms = value.readUInt32LE(0);
+    } else if (type === SNAPSHOT_REC_HISTORY_QUERY && value.length >= 10) {
+      history.id = value[0];
+      history.tier = value[1];
+    } else if (type === SNAPSHOT_REC_HISTORY_SAMPLES) {
+      let ts = history.samples.length ? history.samples[history.samples.length - 1].ts_s : 0;
+      for (let p = 0; p < value.length; ) {
+        const dt = readVarint(value, p);
+        const mA = dt && readVarint(value, dt.pos);
+        const mV = mA && readVarint(value, mA.pos);
+        if (!mV) break;
+        ts += dt.value;
+        history.samples.push({ ts_s: ts, mA: unZigZag(mA.value), mV: mV.value });
+        p = mV.pos;
+      }
+    }
+  });
+
+  return history;
+}
+
+module.exports = {
+  SNAPSHOT_MAGIC,
+  SNAPSHOT_FLAG_KEYFRAME,
+  SNAPSHOT_FLAG_HISTORY,
+  SNAPSHOT_mA_SCALE,
+  SNAPSHOT_mV_SCALE,
+  SNAPSHOT_PACKED_SMOKE,
+  SNAPSHOT_PACKED_FIRE,
+  SNAPSHOT_PACKED_ALARM_VALID,
+  SNAPSHOT_PACKED_CHARGE_VALID,
+  SNAPSHOT_PACKED_CHARGE_SHIFT,
+  crc16,
+  nextSnapshotFrame,
+  decodeSnapshotDevices,
+  decodeHistory
+};